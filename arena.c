@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include "arena.h"
+
+#define ALIGN (sizeof(void *) > sizeof(long long) ? sizeof(void *) : sizeof(long long))
+
+static arena_block *new_block(size_t size, arena_block *next)
+{
+    if (size < ARENA_BLOCK_SIZE)
+    {
+        size = ARENA_BLOCK_SIZE;
+    }
+    arena_block *block = malloc(sizeof(arena_block) + size);
+    block->next = next;
+    block->used = 0;
+    block->size = size;
+    return block;
+}
+
+void init_arena(arena *a)
+{
+    a->head = NULL;
+}
+
+void *arena_alloc(arena *a, size_t size)
+{
+    size = (size + ALIGN - 1) & ~(ALIGN - 1);
+    if (a->head == NULL || a->head->size - a->head->used < size)
+    {
+        // old blocks stay where they are, everything already handed out has to stay valid
+        a->head = new_block(a->head == NULL ? size : 2 * (a->head->size > size ? a->head->size : size), a->head);
+    }
+    void *mem = a->head->mem + a->head->used;
+    a->head->used += size;
+    return mem;
+}
+
+void arena_reset(arena *a)
+{
+    if (a->head == NULL)
+    {
+        return;
+    }
+    if (a->head->next != NULL)
+    {
+        // it took more than one block last time, so swap them all for one block big enough
+        size_t total = 0;
+        while (a->head != NULL)
+        {
+            arena_block *next = a->head->next;
+            total += a->head->size;
+            free(a->head);
+            a->head = next;
+        }
+        a->head = new_block(total, NULL);
+    }
+    a->head->used = 0;
+}
+
+void free_arena(arena *a)
+{
+    while (a->head != NULL)
+    {
+        arena_block *next = a->head->next;
+        free(a->head);
+        a->head = next;
+    }
+}
@@ -0,0 +1,41 @@
+/*
+    Arena (bump) allocator, for memory that all dies at the same time -- in the shell, everything parsed
+    out of one command line. Allocating is a pointer bump, there is no per-allocation free, and
+    arena_reset() throws everything away at once (keeping the memory for next time).
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE 4096 // smallest block the arena asks malloc for
+
+typedef struct arena_block
+{
+    struct arena_block *next; // older (full) blocks
+    size_t used;              // bytes of mem handed out
+    size_t size;              // bytes of mem available
+    char mem[];
+} arena_block;
+
+typedef struct arena
+{
+    arena_block *head; // block currently being handed out, NULL until the first allocation
+} arena;
+
+/* Set up an empty arena */
+void init_arena(arena *a);
+
+/* Returns size bytes of memory (aligned for any pointer or integer type) that stay valid until the
+   next arena_reset() */
+void *arena_alloc(arena *a, size_t size);
+
+/* Release everything allocated from the arena in one go. Memory is kept around for reuse, so an arena
+   that is reset after every command line stops calling malloc once it has seen the longest line. */
+void arena_reset(arena *a);
+
+/* Give all of the arena's memory back */
+void free_arena(arena *a);
+
+#endif
@@ -0,0 +1,137 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch_file.h"
+
+// read everything fd has into memory, for files that can't be mapped
+static int read_all(bfile *file, int fd)
+{
+    size_t capacity = BATCH_BLOCK_SIZE;
+    file->data = malloc(capacity);
+    file->len = 0;
+    ssize_t n;
+    while ((n = read(fd, file->data + file->len, capacity - file->len)) != 0)
+    {
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            free(file->data);
+            file->data = NULL;
+            return 0;
+        }
+        file->len += n;
+        if (file->len == capacity)
+        {
+            capacity *= 2;
+            file->data = realloc(file->data, capacity);
+        }
+    }
+    return 1;
+}
+
+int open_batch(bfile *file, char *path)
+{
+    file->data = NULL;
+    file->len = 0;
+    file->pos = 0;
+    file->mapped = 0;
+    file->tail = NULL;
+
+    // close-on-exec, none of the commands in the batch have any business with it
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return 0;
+    }
+    if (S_ISREG(st.st_mode) && st.st_size == 0)
+    {
+        close(fd);
+        return 1; // nothing to run
+    }
+
+    int ok = 1;
+    // private and writable, so the line breaks can be turned into terminators without touching the file
+    char *map = S_ISREG(st.st_mode) ? mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (map != MAP_FAILED)
+    {
+        // read front to back once, so let the kernel read ahead as far as it likes
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        file->data = map;
+        file->len = st.st_size;
+        file->mapped = 1;
+    }
+    else
+    {
+        ok = read_all(file, fd);
+    }
+    close(fd); // the mapping doesn't need it
+    return ok;
+}
+
+char *next_batch_line(bfile *file)
+{
+    while (file->pos < file->len)
+    {
+        char *line = file->data + file->pos;
+        char *end = file->data + file->len;
+        char *newline = memchr(line, '\n', end - line);
+        if (newline != NULL)
+        {
+            *newline = '\0';
+            file->pos = newline + 1 - file->data;
+        }
+        else
+        {
+            // last line has no line break to terminate it with (and there may be no room past it in the
+            // mapping), so this one gets copied
+            file->pos = file->len;
+            file->tail = malloc((end - line) + 1);
+            memcpy(file->tail, line, end - line);
+            file->tail[end - line] = '\0';
+            line = file->tail;
+        }
+
+        while (*line == ' ' || *line == '\t') // skip all leading spaces
+        {
+            line++;
+        }
+        if (*line != '\0' && *line != '#')
+        {
+            return line;
+        }
+    }
+    return NULL;
+}
+
+void close_batch(bfile *file)
+{
+    if (file->data != NULL)
+    {
+        if (file->mapped)
+        {
+            munmap(file->data, file->len);
+        }
+        else
+        {
+            free(file->data);
+        }
+        file->data = NULL;
+    }
+    free(file->tail);
+    file->tail = NULL;
+}
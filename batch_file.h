@@ -0,0 +1,42 @@
+/*
+    Reader for batch files (./twoShell filename.txt).
+    The batch file is memory mapped and each line is handed out where it sits in the mapping, line
+    break turned into a terminator, so there's no per-line copy (or allocation) however big the file is,
+    and finding each line is one memchr(). Files that can't be mapped (pipes, /dev/stdin) are read in
+    big blocks instead.
+    The shell's own stdin is left alone, so commands in the batch that read stdin don't eat the batch file.
+*/
+
+#ifndef BATCH_FILE_H
+#define BATCH_FILE_H
+
+#include <stddef.h>
+
+#define BATCH_BLOCK_SIZE 65536
+
+typedef struct batch_file
+{
+    char *data;   // the whole file, lines handed out by next_batch_line point in here
+    size_t len;   // length of data
+    size_t pos;   // where the next line starts
+    int mapped;   // 1 if data is a mapping of the file, 0 if it was read into memory
+    char *tail;   // copy of the last line, if the file doesn't end with a line break
+} bfile;
+
+/*
+    Open the batch file at path. Returns 1 if it could be opened and read, 0 otherwise (errno says why).
+*/
+int open_batch(bfile *file, char *path);
+
+/*
+    Returns the next line of the batch file with its leading spaces skipped, NULL once there are no more.
+    Blank lines and comments (lines starting with '#') are skipped. Lines stay valid until close_batch.
+*/
+char *next_batch_line(bfile *file);
+
+/*
+    Release the batch file. Every line next_batch_line handed out goes with it.
+*/
+void close_batch(bfile *file);
+
+#endif
@@ -0,0 +1,331 @@
+/*
+    End to end benchmark of batch mode. Run with "make bench-batch", or
+        ./bench/batch [-n lines] [-j workers] [shell]
+    Generates batch files of a few different shapes (lots of true, two stage pipes, redirections,
+    background jobs, batch-sample.txt over and over), runs the shell (./twoShell by default) on each
+    and reports commands/sec, the shell's overhead per command, and the shell's peak RSS.
+    Overhead is the shell's time per command minus what it takes this program to posix_spawn and wait
+    for the same command itself, so it's just what the shell adds on top. true and echo are run by
+    their full paths for that, since the shell runs plain "true" and "echo" itself (builtins.h). The
+    "(builtin)" shapes run them that way, and there's no spawn to compare them to.
+    The "stamp" shape runs this program as every command, each one writing down the time it started.
+    The gap between one command starting and the next one starting is the shell's whole turnaround
+    (reap, read the next line, parse, spawn, exec), and its percentiles are the latency reported.
+*/
+
+#define _GNU_SOURCE // environ
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static long long now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static int compare_longs(const void *a, const void *b)
+{
+    long long x = *(long long *)a, y = *(long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+// --stamp file: append the time to file and exit, as fast as possible
+static int stamp(char *path)
+{
+    long long t = now_ns();
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    if (fd == -1 || write(fd, &t, sizeof(t)) != sizeof(t))
+    {
+        return 1;
+    }
+    return 0;
+}
+
+// ns it takes to posix_spawn and wait for argv ourselves, per run (best of a few tries)
+static double direct_ns(char **argv, int runs)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    double best = 0;
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        long long t = now_ns();
+        for (int i = 0; i < runs; i++)
+        {
+            pid_t pid;
+            if (posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ) == 0)
+            {
+                waitpid(pid, NULL, 0);
+            }
+        }
+        double per_run = (double)(now_ns() - t) / runs;
+        if (attempt == 0 || per_run < best)
+        {
+            best = per_run;
+        }
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    return best;
+}
+
+// run the shell on the batch file with its output thrown away. Returns wall ns, *max_rss_kb gets the
+// shell's peak RSS (wait4 reports the largest of the shell and anything it waited on, and every
+// command here is far smaller than the shell)
+static long long run_shell(char *shell, int workers, char *batch, long *max_rss_kb)
+{
+    char jobs[16];
+    snprintf(jobs, sizeof(jobs), "%d", workers);
+    char *argv[] = {shell, "-j", jobs, batch, NULL};
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+    long long t = now_ns();
+    pid_t pid;
+    if (posix_spawn(&pid, shell, &actions, NULL, argv, environ) != 0)
+    {
+        perror(shell);
+        exit(1);
+    }
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    t = now_ns() - t;
+    posix_spawn_file_actions_destroy(&actions);
+    *max_rss_kb = usage.ru_maxrss;
+    return t;
+}
+
+// write lines copies of line (which may have one %s in it, for a scratch file name) to a new batch
+// file and return its name
+static char *make_batch(char *line, int lines, char *scratch)
+{
+    static char path[64];
+    strcpy(path, "/tmp/twoshell-bench-XXXXXX");
+    int fd = mkstemp(path);
+    FILE *f = fdopen(fd, "w");
+    for (int i = 0; i < lines; i++)
+    {
+        fprintf(f, line, scratch);
+        fputc('\n', f);
+    }
+    fclose(f);
+    return path;
+}
+
+// write copies copies of text, as is, to a new batch file and return its name
+static char *make_copies(char *text, int copies)
+{
+    static char path[64];
+    strcpy(path, "/tmp/twoshell-bench-XXXXXX");
+    int fd = mkstemp(path);
+    FILE *f = fdopen(fd, "w");
+    for (int i = 0; i < copies; i++)
+    {
+        fputs(text, f);
+    }
+    fclose(f);
+    return path;
+}
+
+// the contents of path (ending in a newline), with *commands set to how many commands it runs: one
+// per non-blank line plus one more for every pipe. NULL if it can't be read
+static char *read_sample(char *path, int *commands)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        return NULL;
+    }
+    size_t size = 0, capacity = 4096;
+    char *text = malloc(capacity);
+    size_t got;
+    while ((got = fread(text + size, 1, capacity - size - 1, f)) > 0)
+    {
+        size += got;
+        if (size + 1 == capacity)
+        {
+            capacity *= 2;
+            text = realloc(text, capacity);
+        }
+    }
+    fclose(f);
+    if (size > 0 && text[size - 1] != '\n')
+    {
+        text[size++] = '\n';
+    }
+    text[size] = '\0';
+
+    *commands = 0;
+    int blank = 1;
+    for (char *c = text; *c != '\0'; c++)
+    {
+        if (*c == '\n')
+        {
+            *commands += !blank;
+            blank = 1;
+        }
+        else if (*c != ' ' && *c != '\t')
+        {
+            blank = 0;
+            *commands += *c == '|';
+        }
+    }
+    return text;
+}
+
+// run the shell on batch (lines lines, commands commands each) and delete it. If the commands are all
+// direct, the overhead is worked out too.
+static void bench_batch(char *name, char *shell, int workers, int lines, char *batch, int commands,
+                        char **direct)
+{
+    long max_rss_kb;
+    long long wall = run_shell(shell, workers, batch, &max_rss_kb);
+    unlink(batch);
+
+    double per_line = (double)wall / lines;
+    printf("%-28s %7d %12.0f %12.1f ", name, lines, lines * commands / (wall / 1e9), per_line / 1000);
+    if (direct != NULL)
+    {
+        printf("%12.1f", (per_line - direct_ns(direct, 200) * commands) / 1000);
+    }
+    else
+    {
+        printf("%12s", "-");
+    }
+    printf(" %10ld\n", max_rss_kb);
+    fflush(stdout);
+}
+
+// each line of the shape runs commands commands
+static void bench_shape(char *name, char *shell, int workers, int lines, char *line, char *scratch,
+                        int commands, char **direct)
+{
+    bench_batch(name, shell, workers, lines, make_batch(line, lines, scratch), commands, direct);
+}
+
+// the stamp shape, see the top of the file
+static void bench_latency(char *shell, char *self, int lines)
+{
+    char stamps[] = "/tmp/twoshell-stamps-XXXXXX";
+    close(mkstemp(stamps));
+    unlink(stamps); // each command creates it if it has to
+
+    char line[512];
+    snprintf(line, sizeof(line), "%s --stamp %s", self, "%s");
+    char *batch = make_batch(line, lines, stamps);
+    long max_rss_kb;
+    run_shell(shell, 1, batch, &max_rss_kb);
+    unlink(batch);
+
+    long long *times = malloc(sizeof(long long) * lines);
+    int fd = open(stamps, O_RDONLY);
+    int count = fd == -1 ? 0 : read(fd, times, sizeof(long long) * lines) / sizeof(long long);
+    close(fd);
+    unlink(stamps);
+    if (count < 2)
+    {
+        fprintf(stderr, "no stamps recorded, is %s runnable?\n", self);
+        return;
+    }
+
+    long long *gaps = malloc(sizeof(long long) * count);
+    for (int i = 1; i < count; i++)
+    {
+        gaps[i - 1] = times[i] - times[i - 1];
+    }
+    qsort(gaps, count - 1, sizeof(long long), compare_longs);
+    int n = count - 1;
+    printf("\ncommand to command latency (us), %d commands:\n", count);
+    printf("%12s %12s %12s %12s %12s\n", "p50", "p90", "p99", "p99.9", "max");
+    printf("%12.1f %12.1f %12.1f %12.1f %12.1f\n", gaps[n / 2] / 1e3, gaps[n * 90 / 100] / 1e3,
+           gaps[n * 99 / 100] / 1e3, gaps[n * 999 / 1000] / 1e3, gaps[n - 1] / 1e3);
+    free(times);
+    free(gaps);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3 && !strcmp(argv[1], "--stamp"))
+    {
+        return stamp(argv[2]);
+    }
+
+    int lines = 2000;
+    int workers = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:j:")) != -1)
+    {
+        if (opt == 'n')
+        {
+            lines = atoi(optarg);
+        }
+        else if (opt == 'j')
+        {
+            workers = atoi(optarg);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-n lines] [-j workers] [shell]\n", argv[0]);
+            return 1;
+        }
+    }
+    char *shell = optind < argc ? argv[optind] : "./twoShell";
+    char self[4096];
+    ssize_t self_len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    self[self_len > 0 ? self_len : 0] = '\0';
+
+    char scratch[] = "/tmp/twoshell-scratch-XXXXXX";
+    close(mkstemp(scratch));
+
+    char *true_argv[] = {"/bin/true", NULL};
+    char *echo_argv[] = {"/bin/echo", "hello", NULL};
+    printf("%s, %d lines per batch, -j %d\n", shell, lines, workers);
+    printf("%-28s %7s %12s %12s %12s %10s\n", "shape", "lines", "cmds/sec", "us/line", "overhead us", "rss KB");
+    bench_shape("/bin/true", shell, workers, lines, "/bin/true", scratch, 1, true_argv);
+    bench_shape("/bin/true | /bin/true", shell, workers, lines, "/bin/true | /bin/true", scratch, 2, true_argv);
+    bench_shape("/bin/echo hello > file", shell, workers, lines, "/bin/echo hello > %s", scratch, 1, echo_argv);
+    bench_shape("true (builtin)", shell, workers, lines, "true", scratch, 1, NULL);
+    bench_shape("true | true (builtin)", shell, workers, lines, "true | true", scratch, 2, NULL);
+    bench_shape("echo hello > file (builtin)", shell, workers, lines, "echo hello > %s", scratch, 1, NULL);
+    bench_shape("cat < file | wc -c", shell, workers, lines, "cat < %s | wc -c", scratch, 2, NULL);
+    // the wait at the end is part of the run, so this is how fast they can be started and reaped
+    char *background = make_batch("true &", lines, scratch);
+    FILE *f = fopen(background, "a");
+    fputs("wait\n", f);
+    fclose(f);
+    long max_rss_kb;
+    long long wall = run_shell(shell, workers, background, &max_rss_kb);
+    unlink(background);
+    printf("%-28s %7d %12.0f %12.1f %12s %10ld\n", "true & (then wait)", lines, lines / (wall / 1e9),
+           (double)wall / lines / 1000, "-", max_rss_kb);
+    // batch-sample.txt ends in history, which prints everything so far, so keep that one short
+    // (one "line" here is the whole file)
+    int sample_commands;
+    char *sample = read_sample("batch-sample.txt", &sample_commands);
+    if (sample != NULL)
+    {
+        bench_batch("batch-sample.txt (x50)", shell, workers, 50, make_copies(sample, 50),
+                    sample_commands, NULL);
+        free(sample);
+    }
+    else
+    {
+        perror("batch-sample.txt");
+    }
+    unlink(scratch);
+
+    bench_latency(shell, self, lines);
+    return 0;
+}
@@ -0,0 +1,313 @@
+/*
+    Keystroke latency benchmark. Run with "make bench-keys", or
+        ./bench/keys [shell]
+    Starts the shell (./twoShell by default) on a pseudo-terminal, the way a terminal emulator would, with
+    a history of 1k, 10k and 100k commands, and types at it: a line one key at a time, backspacing it
+    away, scrolling up and down through history, and typing with auto-complete (CTRL-C) on. Each
+    keystroke is timed from writing it to the terminal to the first of the shell's output showing up,
+    which is the lag a user sees.
+    The history file is written once, 100k commands long, and TWOSHELL_HISTSIZE picks how much of the
+    end of it each run loads. A row where some keys got no answer is left out, not reported on what's
+    left of it.
+*/
+
+#define _XOPEN_SOURCE 600 // posix_openpt and friends
+#define _DEFAULT_SOURCE   // mkdtemp
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_SAMPLES 100000
+#define TYPED_LINE "echo the quick brown fox jumps over the lazy dog"
+#define COMPLETED_PREFIX "echo command number 4"
+#define MAX_HISTORY 100000
+
+typedef struct samples
+{
+    long long ns[MAX_SAMPLES];
+    int count;
+} samples;
+
+static int pty = -1; // our end of the terminal
+static long history_bytes; // how long make_home's history file is
+
+static long long now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static int compare_longs(const void *a, const void *b)
+{
+    long long x = *(long long *)a, y = *(long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+// read whatever the shell has written for up to wait_ms. Returns bytes read (and thrown away)
+static int drain(int wait_ms)
+{
+    char buf[65536];
+    int total = 0;
+    struct pollfd p = {pty, POLLIN, 0};
+    while (poll(&p, 1, wait_ms) > 0)
+    {
+        int n = read(pty, buf, sizeof(buf));
+        if (n <= 0)
+        {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+// read until the prompt shows up
+static int wait_for_prompt(void)
+{
+    char buf[65536];
+    int used = 0;
+    struct pollfd p = {pty, POLLIN, 0};
+    while (poll(&p, 1, 10000) > 0)
+    {
+        int n = read(pty, buf + used, sizeof(buf) - 1 - used);
+        if (n <= 0)
+        {
+            return 0;
+        }
+        used += n;
+        buf[used] = '\0';
+        if (strstr(buf, "% ") != NULL)
+        {
+            return 1;
+        }
+        if (used > (int)sizeof(buf) / 2)
+        {
+            // keep the end, the prompt could be split across reads
+            memmove(buf, buf + used - 16, 16);
+            used = 16;
+        }
+    }
+    return 0;
+}
+
+// send key and time how long until the shell starts answering. Anything else it has to say gets
+// drained (untimed) so it doesn't count towards the next key.
+static void press(char *key, samples *s)
+{
+    char byte;
+    struct pollfd p = {pty, POLLIN, 0};
+    long long t = now_ns();
+    if (write(pty, key, strlen(key)) != (ssize_t)strlen(key))
+    {
+        return;
+    }
+    if (poll(&p, 1, 500) > 0 && read(pty, &byte, 1) == 1)
+    {
+        if (s != NULL && s->count < MAX_SAMPLES)
+        {
+            s->ns[s->count++] = now_ns() - t;
+        }
+    }
+    drain(1);
+}
+
+// expected is how many presses there were, every one should have been answered
+static void report(char *name, int history_size, samples *s, int expected)
+{
+    if (s->count < expected)
+    {
+        printf("%-22s %9d   only %d of %d presses answered, not reported\n", name, history_size, s->count,
+               expected);
+        s->count = 0;
+        return;
+    }
+    qsort(s->ns, s->count, sizeof(long long), compare_longs);
+    printf("%-22s %9d %7d %9.1f %9.1f %9.1f %9.1f\n", name, history_size, s->count, s->ns[s->count / 2] / 1e3,
+           s->ns[s->count * 90 / 100] / 1e3, s->ns[s->count * 99 / 100] / 1e3, s->ns[s->count - 1] / 1e3);
+    s->count = 0;
+    fflush(stdout);
+}
+
+// start the shell on a new pseudo-terminal with the given HOME, keeping the last history_size commands
+// of its history. Returns its pid.
+static pid_t start_shell(char *shell, char *home, int history_size)
+{
+    pty = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty == -1 || grantpt(pty) == -1 || unlockpt(pty) == -1)
+    {
+        perror("pty");
+        exit(1);
+    }
+    char *name = ptsname(pty);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        setsid(); // so the pty becomes our controlling terminal when it's opened
+        int tty = open(name, O_RDWR);
+        dup2(tty, 0);
+        dup2(tty, 1);
+        dup2(tty, 2);
+        close(tty);
+        close(pty);
+        char limit[16];
+        snprintf(limit, sizeof(limit), "%d", history_size);
+        setenv("HOME", home, 1);
+        setenv("TWOSHELL_HISTSIZE", limit, 1);
+        execl(shell, shell, (char *)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+// writes the history file every run uses, in a new HOME. Returns the HOME (static).
+static char *make_home(void)
+{
+    static char home[] = "/tmp/twoshell-keys-XXXXXX";
+    char path[128];
+    mkdtemp(home);
+    snprintf(path, sizeof(path), "%s/.twoshell_history", home);
+    FILE *f = fopen(path, "w");
+    char *prefix = COMPLETED_PREFIX;
+    int length = strlen(prefix);
+    for (int i = 0; i < MAX_HISTORY - length; i++)
+    {
+        fprintf(f, "echo command number %d with some args\n", i);
+    }
+    // auto-complete only redraws when the suggestion changes, and a key that just matches what's
+    // already suggested changes nothing on the screen, so there'd be nothing to time. These make every
+    // key of the prefix change it: the newest command starting with the first k characters is the first
+    // k characters and then a ~, so typing character k + 1 always takes a different suggestion.
+    for (int k = length; k > 0; k--)
+    {
+        fprintf(f, "%.*s~\n", k, prefix);
+    }
+    history_bytes = ftell(f);
+    fclose(f);
+    return home;
+}
+
+static void bench_history_size(char *shell, char *home, int history_size, samples *s)
+{
+    // the last run added its commands to the file (a hundred "true"s the up arrow wouldn't show moving
+    // through), take them back off
+    char path[128];
+    snprintf(path, sizeof(path), "%s/.twoshell_history", home);
+    if (truncate(path, history_bytes) == -1)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    pid_t pid = start_shell(shell, home, history_size);
+    if (!wait_for_prompt())
+    {
+        fprintf(stderr, "%s never showed a prompt\n", shell);
+        exit(1);
+    }
+
+    char key[2] = {0, 0};
+    char *line = TYPED_LINE;
+    int length = strlen(line);
+    for (int n = 0; n < 20; n++)
+    {
+        for (int i = 0; i < length; i++)
+        {
+            key[0] = line[i];
+            press(key, s);
+        }
+    }
+    // (each round types the line on the end of what's already there, so there's lots to backspace)
+    report("type", history_size, s, length * 20);
+    for (int i = 0; i < length * 20; i++)
+    {
+        press("\x7f", s);
+    }
+    report("backspace", history_size, s, length * 20);
+
+    for (int i = 0; i < 500; i++)
+    {
+        press("\x1b[A", s);
+    }
+    report("up arrow", history_size, s, 500);
+    for (int i = 0; i < 500; i++)
+    {
+        press("\x1b[B", s);
+    }
+    report("down arrow", history_size, s, 500);
+
+    // CTRL-C turns auto-complete on. It's a signal, nothing is printed, so give it a moment.
+    press("\x03", NULL);
+    drain(20);
+    char *prefix = COMPLETED_PREFIX;
+    for (int n = 0; n < 20; n++)
+    {
+        for (int i = 0; prefix[i] != '\0'; i++)
+        {
+            key[0] = prefix[i];
+            press(key, s);
+        }
+        // clear the line for the next round, rather than running it (which would put it in the history
+        // and spoil the suggestions). Deleting the suggestion takes what's left, then deletes that.
+        char deletes[64];
+        memset(deletes, '\x7f', sizeof(deletes));
+        if (write(pty, deletes, sizeof(deletes)) != sizeof(deletes))
+        {
+            break;
+        }
+        drain(20);
+    }
+    report("type (auto-complete)", history_size, s, 20 * strlen(prefix));
+    press("\x03", NULL);
+    drain(20);
+
+    // the round trip of running a command, enter to the next prompt
+    for (int n = 0; n < 100; n++)
+    {
+        key[0] = 't';
+        press(key, NULL);
+        press("r", NULL);
+        press("u", NULL);
+        press("e", NULL);
+        long long t = now_ns();
+        if (write(pty, "\n", 1) == 1 && wait_for_prompt() && s->count < MAX_SAMPLES)
+        {
+            s->ns[s->count++] = now_ns() - t;
+        }
+    }
+    report("enter (run true)", history_size, s, 100);
+
+    if (write(pty, "exit\n", 5) != 5 || waitpid(pid, NULL, WNOHANG) == 0)
+    {
+        drain(200);
+        kill(pid, SIGKILL);
+    }
+    waitpid(pid, NULL, 0);
+    close(pty);
+}
+
+int main(int argc, char **argv)
+{
+    char *shell = argc > 1 ? argv[1] : "./twoShell";
+    samples *s = malloc(sizeof(samples));
+    s->count = 0;
+    printf("keystroke to first output (us)\n");
+    printf("%-22s %9s %7s %9s %9s %9s %9s\n", "keys", "history", "presses", "p50", "p90", "p99", "max");
+    char *home = make_home();
+    for (int history_size = 1000; history_size <= MAX_HISTORY; history_size *= 10)
+    {
+        bench_history_size(shell, home, history_size, s);
+    }
+    char path[128];
+    snprintf(path, sizeof(path), "%s/.twoshell_history", home);
+    unlink(path);
+    rmdir(home);
+    free(s);
+    return 0;
+}
@@ -0,0 +1,433 @@
+/*
+    Microbenchmarks for the code that runs on every keystroke (dstring) and every command (history,
+    tokenize/load, copy_arr). Run with "make bench".
+    Each benchmark times a batch of operations at a time, so clock_gettime's own cost (~20ns) doesn't
+    swamp operations that take a couple of ns, and prints ns/op: the mean over every batch, and the
+    50th/90th/99th percentile and worst batch.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../dstring.h"
+#include "../linked_list.h"
+#include "../arena.h"
+#include "../parse.h"
+#include "../helper.h"
+#include "../search.h"
+
+#define SAMPLES 1000 // batches timed per benchmark
+
+typedef struct samples
+{
+    double *ns; // ns per op of each batch
+    int count;
+    int max;
+} samples;
+
+static volatile long sink; // results go here so nothing gets optimized away
+
+static long long now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void start_samples(samples *s, int max)
+{
+    s->ns = malloc(sizeof(double) * max);
+    s->count = 0;
+    s->max = max;
+}
+
+// one batch of ops took ns
+static void record(samples *s, long long ns, int ops)
+{
+    if (s->count < s->max)
+    {
+        s->ns[s->count++] = (double)ns / ops;
+    }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(double *)a, y = *(double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// print the results and throw the samples away
+static void report(char *name, samples *s)
+{
+    double total = 0;
+    qsort(s->ns, s->count, sizeof(double), compare_doubles);
+    for (int i = 0; i < s->count; i++)
+    {
+        total += s->ns[i];
+    }
+    printf("%-44s %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, total / s->count, s->ns[s->count / 2],
+           s->ns[s->count * 90 / 100], s->ns[s->count * 99 / 100], s->ns[s->count - 1]);
+    free(s->ns);
+}
+
+// xorshift, plenty random enough to pick history entries and cheap enough not to show up
+static unsigned int next_random(unsigned int *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void bench_dstring(void)
+{
+    samples s;
+    dstring str;
+    init_string(&str);
+
+    // typing a normal length command line, one character at a time
+    start_samples(&s, SAMPLES);
+    for (int n = 0; n < SAMPLES; n++)
+    {
+        long long t = now_ns();
+        for (int i = 0; i < 80; i++)
+        {
+            add_end(&str, 'a' + i % 26);
+        }
+        record(&s, now_ns() - t, 80);
+        clear_string(&str);
+    }
+    report("add_end (80 char line)", &s);
+
+    // a paste big enough to keep outgrowing the buffer
+    start_samples(&s, SAMPLES);
+    for (int n = 0; n < SAMPLES; n++)
+    {
+        long long t = now_ns();
+        for (int i = 0; i < 8192; i++)
+        {
+            add_end(&str, 'a' + i % 26);
+        }
+        record(&s, now_ns() - t, 8192);
+        clear_string(&str);
+    }
+    report("add_end (8KB paste)", &s);
+
+    // backspacing a whole line
+    start_samples(&s, SAMPLES);
+    for (int n = 0; n < SAMPLES; n++)
+    {
+        for (int i = 0; i < 80; i++)
+        {
+            add_end(&str, 'a' + i % 26);
+        }
+        long long t = now_ns();
+        while (str.size > 0)
+        {
+            remove_dstring_index(&str, str.size - 1);
+        }
+        record(&s, now_ns() - t, 80);
+    }
+    report("remove_dstring_index (backspace, 80 chars)", &s);
+
+    // deleting from the middle of a long line, the worst case for a plain array
+    start_samples(&s, SAMPLES);
+    for (int n = 0; n < SAMPLES; n++)
+    {
+        for (int i = 0; i < 4096; i++)
+        {
+            add_end(&str, 'a' + i % 26);
+        }
+        long long t = now_ns();
+        for (int i = 0; i < 1024; i++)
+        {
+            remove_dstring_index(&str, str.size / 2);
+        }
+        record(&s, now_ns() - t, 1024);
+        clear_string(&str);
+    }
+    report("remove_dstring_index (middle, 4KB line)", &s);
+    clear_string(&str);
+}
+
+static void bench_history(int size)
+{
+    char name[64];
+    char buf[128];
+    samples s;
+    unsigned int state = 12345;
+    // each history is left behind (there's no free for a list), the process doesn't live long
+    llist *history = malloc(sizeof(llist));
+    init_list(history);
+
+    // filling it up, timed 100 commands at a time so the ring doubling shows up in the tail
+    start_samples(&s, size / 100);
+    for (int n = 0; n < size / 100; n++)
+    {
+        char *lines[100];
+        for (int i = 0; i < 100; i++)
+        {
+            snprintf(buf, sizeof(buf), "git commit -m change%d --author someone", n * 100 + i);
+            lines[i] = strdup(buf);
+        }
+        long long t = now_ns();
+        for (int i = 0; i < 100; i++)
+        {
+            add_last(history, lines[i]);
+        }
+        record(&s, now_ns() - t, 100);
+    }
+    snprintf(name, sizeof(name), "add_last (%d entries)", size);
+    report(name, &s);
+
+    // scrolling, which is just get() at some index
+    int indices[1000];
+    start_samples(&s, SAMPLES);
+    for (int n = 0; n < SAMPLES; n++)
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            indices[i] = next_random(&state) % size;
+        }
+        long long t = now_ns();
+        for (int i = 0; i < 1000; i++)
+        {
+            sink += (long)get(history, indices[i]);
+        }
+        record(&s, now_ns() - t, 1000);
+    }
+    snprintf(name, sizeof(name), "get (%d entries)", size);
+    report(name, &s);
+
+    // auto-complete, a prefix some entry starts with and one nothing does
+    char (*prefixes)[48] = malloc(100 * sizeof(*prefixes));
+    for (int miss = 0; miss < 2; miss++)
+    {
+        start_samples(&s, SAMPLES);
+        for (int n = 0; n < SAMPLES; n++)
+        {
+            for (int i = 0; i < 100; i++)
+            {
+                snprintf(prefixes[i], sizeof(prefixes[i]), miss ? "git commit -m chang%u" : "git commit -m change%u",
+                         next_random(&state) % size);
+            }
+            long long t = now_ns();
+            for (int i = 0; i < 100; i++)
+            {
+                sink += contains(history, prefixes[i]);
+            }
+            record(&s, now_ns() - t, 100);
+        }
+        snprintf(name, sizeof(name), "contains %s (%d entries)", miss ? "miss" : "hit", size);
+        report(name, &s);
+    }
+
+    // the same history loaded from the history file, before index_entries has got to any of it, so
+    // contains() checks the entries one at a time
+    llist *loaded = malloc(sizeof(llist));
+    init_list(loaded);
+    for (int i = 0; i < size; i++)
+    {
+        add_last_ref(loaded, get(history, i));
+    }
+    int runs = size >= 100000 ? 20 : 100;
+    for (int miss = 0; miss < 2; miss++)
+    {
+        start_samples(&s, runs);
+        for (int n = 0; n < runs; n++)
+        {
+            snprintf(prefixes[0], sizeof(prefixes[0]), miss ? "git commit -m chang%u" : "git commit -m change%u",
+                     next_random(&state) % size);
+            long long t = now_ns();
+            sink += contains(loaded, prefixes[0]);
+            record(&s, now_ns() - t, 1);
+        }
+        snprintf(name, sizeof(name), "contains %s, unindexed (%d entries)", miss ? "miss" : "hit", size);
+        report(name, &s);
+    }
+
+    // and index_entries catching up on it a chunk at a time, the way the prompt does between keys
+    // (CATCH_UP_CHUNK in twoShell.c). ns per chunk, so the max is the longest a key could wait
+    start_samples(&s, size / 25);
+    for (int n = 0; n < size / 25; n++)
+    {
+        long long t = now_ns();
+        index_entries(loaded, 25);
+        record(&s, now_ns() - t, 1);
+    }
+    snprintf(name, sizeof(name), "index_entries x25 (%d entries)", size);
+    report(name, &s);
+    free(prefixes);
+}
+
+static void bench_search(int size)
+{
+    static char *shapes[] = {"git commit -m change%u", "ls -la dir%u", "cd /src/project%u", "make -j%u",
+                             "grep -rn pattern%u src", "ssh build%u.example.com", "vim file%u.c",
+                             "docker run --rm image%u"};
+    char name[64];
+    char buf[128];
+    samples s;
+    unsigned int state = 777;
+    llist *history = malloc(sizeof(llist));
+    init_list(history);
+    for (int i = 0; i < size; i++)
+    {
+        // plenty of repeats, like a real history
+        snprintf(buf, sizeof(buf), shapes[next_random(&state) % 8], next_random(&state) % (size / 4 + 1));
+        add_last(history, strdup(buf));
+    }
+
+    hsearch search;
+    init_search(&search);
+    int runs = size >= 1000000 ? 20 : 100;
+    // indexing the whole history, which Ctrl-R does if it's pressed before the prompt's had time to
+    start_samples(&s, runs);
+    for (int n = 0; n < runs; n++)
+    {
+        free_search(&search);
+        long long t = now_ns();
+        index_history(&search, history, history->length);
+        record(&s, now_ns() - t, 1);
+    }
+    snprintf(name, sizeof(name), "index_history, all (%d entries)", size);
+    report(name, &s);
+
+    // then after every command, with the history capped so each one drops the oldest entry too
+    set_limit(history, size);
+    start_samples(&s, SAMPLES);
+    for (int n = 0; n < SAMPLES; n++)
+    {
+        add_last(history, strdup(shapes[n % 8]));
+        long long t = now_ns();
+        index_history(&search, history, history->length);
+        record(&s, now_ns() - t, 1);
+    }
+    snprintf(name, sizeof(name), "index_history, 1 more (%d entries)", size);
+    report(name, &s);
+
+    start_samples(&s, runs);
+    for (int n = 0; n < runs; n++)
+    {
+        long long t = now_ns();
+        start_search(&search, history);
+        record(&s, now_ns() - t, 1);
+    }
+    snprintf(name, sizeof(name), "start_search (%d entries)", size);
+    report(name, &s);
+
+    // typing a query a key at a time, the first key looks at every different entry
+    char *queries[] = {"gcm", "vfile1", "dkrun", "zzz"};
+    for (int first = 1; first >= 0; first--)
+    {
+        start_samples(&s, runs * 8);
+        for (int n = 0; n < runs; n++)
+        {
+            for (int q = 0; q < 4; q++)
+            {
+                start_search(&search, history);
+                for (char *c = queries[q]; *c != '\0'; c++)
+                {
+                    long long t = now_ns();
+                    search_add(&search, *c);
+                    if (first == (c == queries[q]))
+                    {
+                        record(&s, now_ns() - t, 1);
+                    }
+                }
+                sink += search_match(&search);
+            }
+        }
+        snprintf(name, sizeof(name), "search_add %s (%d entries)", first ? "1st key" : "later keys", size);
+        report(name, &s);
+    }
+    free_search(&search);
+}
+
+static void bench_parse(char *name, char *line)
+{
+    samples s;
+    arena a;
+    init_arena(&a);
+    start_samples(&s, SAMPLES);
+    for (int n = 0; n < SAMPLES; n++)
+    {
+        long long t = now_ns();
+        for (int i = 0; i < 100; i++)
+        {
+            char **tokens;
+            struct command *commands;
+            int count = tokenize(&a, line, &tokens);
+            sink += load_pipeline(&a, tokens, count, &commands);
+            arena_reset(&a);
+        }
+        record(&s, now_ns() - t, 100);
+    }
+    report(name, &s);
+    free_arena(&a);
+}
+
+static void bench_copy_arr(void)
+{
+    char *args[] = {"grep", "-r", "--include=*.c", "-n", "sigaction", ".", "-A", "3", NULL};
+    samples s;
+    start_samples(&s, SAMPLES);
+    for (int n = 0; n < SAMPLES; n++)
+    {
+        long long t = now_ns();
+        for (int i = 0; i < 100; i++)
+        {
+            char **copy;
+            copy_arr(args, &copy, 0, 8);
+            sink += (long)copy[7];
+            free_arr(&copy, 8);
+        }
+        record(&s, now_ns() - t, 100);
+    }
+    report("copy_arr + free_arr (8 args)", &s);
+}
+
+int main(void)
+{
+    printf("%-44s %9s %9s %9s %9s %9s\n", "ns/op", "mean", "p50", "p90", "p99", "max");
+
+    bench_dstring();
+
+    for (int size = 1000; size <= 1000000; size *= 10)
+    {
+        bench_history(size);
+    }
+    for (int size = 1000; size <= 1000000; size *= 10)
+    {
+        bench_search(size);
+    }
+
+    bench_parse("tokenize + load (typical)", "cat access.log | grep -v healthcheck | sort -u > out.txt");
+    bench_parse("tokenize + load (redirects)", "sort -k 2 -n < in.txt >> out.txt");
+    // one character tokens, the most tokens a line this long can have
+    char *dense = malloc(8193);
+    for (int i = 0; i < 8192; i++)
+    {
+        dense[i] = i % 2 ? ' ' : 'a';
+    }
+    dense[8192] = '\0';
+    bench_parse("tokenize + load (8KB of 1 char tokens)", dense);
+    // a 1000 stage pipeline
+    char *piped = malloc(4001);
+    for (int i = 0; i < 4000; i += 4)
+    {
+        memcpy(piped + i, "a | ", 4);
+    }
+    piped[3998] = '\0';
+    bench_parse("tokenize + load (1000 stage pipeline)", piped);
+    // no whitespace at all
+    char *single = malloc(8193);
+    memset(single, 'a', 8192);
+    single[8192] = '\0';
+    bench_parse("tokenize + load (8KB single token)", single);
+
+    bench_copy_arr();
+    return 0;
+}
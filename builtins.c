@@ -0,0 +1,728 @@
+#define _GNU_SOURCE // splice
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h> // PATH_MAX
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "builtins.h"
+
+/*
+    Escapes, shared by echo -e, printf's format and printf's %b
+*/
+
+// prints the escape sequence *s points at (just past the backslash) to out, and moves *s past it.
+// leading_zero is set for echo and %b, where octal is \0nnn, printf's format uses \nnn.
+// Returns 1 for \c, which means stop printing altogether.
+static int put_escape(FILE *out, char **s, int leading_zero)
+{
+    char *p = *s;
+    int c;
+    switch (*p)
+    {
+    case 'a': c = '\a'; break;
+    case 'b': c = '\b'; break;
+    case 'e': c = 27; break;
+    case 'f': c = '\f'; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 't': c = '\t'; break;
+    case 'v': c = '\v'; break;
+    case '\\': c = '\\'; break;
+    case 'c':
+        *s = p + 1;
+        return 1;
+    case '\0':
+        fputc('\\', out); // a backslash at the very end is just a backslash
+        return 0;
+    case 'x':
+        c = 0;
+        for (int digits = 0; digits < 2 && p[1] != '\0' && strchr("0123456789abcdefABCDEF", p[1]) != NULL; digits++)
+        {
+            p++;
+            c = c * 16 + (*p <= '9' ? *p - '0' : (*p | 0x20) - 'a' + 10);
+        }
+        if (p == *s)
+        {
+            fputs("\\x", out); // no digits, not an escape
+            *s = p + 1;
+            return 0;
+        }
+        break;
+    default:
+        if (*p >= '0' && *p <= '7' && (!leading_zero || *p == '0'))
+        {
+            c = 0;
+            int digits = 0;
+            if (leading_zero)
+            {
+                p++; // the 0 doesn't count as one of the three
+            }
+            for (; digits < 3 && *p >= '0' && *p <= '7'; digits++, p++)
+            {
+                c = c * 8 + (*p - '0');
+            }
+            fputc(c & 0xff, out);
+            *s = p;
+            return 0;
+        }
+        // not an escape either, both characters go out as they are
+        fputc('\\', out);
+        c = *p;
+        break;
+    }
+    fputc(c, out);
+    *s = p + 1;
+    return 0;
+}
+
+// prints s with its escapes expanded, returns 1 if it had a \c in it
+static int put_escaped(FILE *out, char *s)
+{
+    while (*s != '\0')
+    {
+        if (*s == '\\')
+        {
+            s++;
+            if (put_escape(out, &s, 1))
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            fputc(*s++, out);
+        }
+    }
+    return 0;
+}
+
+/*
+    echo [-neE] [string ...]
+*/
+static int echo_builtin(char **argv)
+{
+    int newline = 1;
+    int escapes = 0;
+    int i = 1;
+    // like coreutils' echo, an argument is only flags if every letter in it is n, e or E
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0' &&
+           strspn(argv[i] + 1, "neE") == strlen(argv[i] + 1);
+         i++)
+    {
+        for (char *flag = argv[i] + 1; *flag != '\0'; flag++)
+        {
+            if (*flag == 'n')
+            {
+                newline = 0;
+            }
+            else
+            {
+                escapes = *flag == 'e';
+            }
+        }
+    }
+
+    for (int first = i; argv[i] != NULL; i++)
+    {
+        if (i > first)
+        {
+            putchar(' ');
+        }
+        if (!escapes)
+        {
+            fputs(argv[i], stdout);
+        }
+        else if (put_escaped(stdout, argv[i]))
+        {
+            return 0; // \c, not even the newline
+        }
+    }
+    if (newline)
+    {
+        putchar('\n');
+    }
+    return 0;
+}
+
+/*
+    pwd
+*/
+static int pwd_builtin(char **argv)
+{
+    char dir[PATH_MAX];
+    if (getcwd(dir, sizeof(dir)) == NULL)
+    {
+        perror("pwd");
+        return 1;
+    }
+    puts(dir);
+    return 0;
+}
+
+static int true_builtin(char **argv)
+{
+    return 0;
+}
+
+static int false_builtin(char **argv)
+{
+    return 1;
+}
+
+/*
+    test expression, [ expression ]
+    Parsed by recursive descent, loosest first: -o, then -a, then !, then a primary (a unary or binary
+    test, a parenthesized expression, or a lone string that's true if it's not empty).
+*/
+
+typedef struct test_state
+{
+    char **argv;
+    int pos;   // next argument to look at
+    int end;   // one past the last argument of the expression (so not including ])
+    char *err; // set to what went wrong, the whole test is then an error (status 2)
+} test_state;
+
+static int test_or(test_state *t);
+
+// parses s as a whole integer for the -eq family
+static long long test_int(test_state *t, char *s)
+{
+    char *end;
+    errno = 0;
+    long long value = strtoll(s, &end, 10);
+    if (end == s || *end != '\0' || errno != 0)
+    {
+        t->err = "integer expression expected";
+    }
+    return value;
+}
+
+static int is_binary_op(char *op)
+{
+    static char *ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+                          "-nt", "-ot", "-ef", NULL};
+    for (int i = 0; ops[i] != NULL; i++)
+    {
+        if (!strcmp(op, ops[i]))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int test_binary(test_state *t, char *left, char *op, char *right)
+{
+    if (!strcmp(op, "=") || !strcmp(op, "=="))
+    {
+        return !strcmp(left, right);
+    }
+    if (!strcmp(op, "!="))
+    {
+        return strcmp(left, right) != 0;
+    }
+    if (!strcmp(op, "<"))
+    {
+        return strcmp(left, right) < 0;
+    }
+    if (!strcmp(op, ">"))
+    {
+        return strcmp(left, right) > 0;
+    }
+    if (!strcmp(op, "-nt") || !strcmp(op, "-ot") || !strcmp(op, "-ef"))
+    {
+        struct stat l, r;
+        int l_ok = stat(left, &l) == 0;
+        int r_ok = stat(right, &r) == 0;
+        if (!strcmp(op, "-ef"))
+        {
+            return l_ok && r_ok && l.st_dev == r.st_dev && l.st_ino == r.st_ino;
+        }
+        // a file that doesn't exist is older than one that does
+        if (!strcmp(op, "-nt"))
+        {
+            return l_ok && (!r_ok || l.st_mtim.tv_sec > r.st_mtim.tv_sec ||
+                            (l.st_mtim.tv_sec == r.st_mtim.tv_sec && l.st_mtim.tv_nsec > r.st_mtim.tv_nsec));
+        }
+        return r_ok && (!l_ok || l.st_mtim.tv_sec < r.st_mtim.tv_sec ||
+                        (l.st_mtim.tv_sec == r.st_mtim.tv_sec && l.st_mtim.tv_nsec < r.st_mtim.tv_nsec));
+    }
+
+    long long l = test_int(t, left);
+    long long r = test_int(t, right);
+    switch (op[1] * 256 + op[2])
+    {
+    case 'e' * 256 + 'q': return l == r;
+    case 'n' * 256 + 'e': return l != r;
+    case 'l' * 256 + 't': return l < r;
+    case 'l' * 256 + 'e': return l <= r;
+    case 'g' * 256 + 't': return l > r;
+    default: return l >= r; // -ge
+    }
+}
+
+static int test_unary(test_state *t, char op, char *arg)
+{
+    struct stat st;
+    switch (op)
+    {
+    case 'n': return arg[0] != '\0';
+    case 'z': return arg[0] == '\0';
+    case 't': return isatty((int)test_int(t, arg));
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    case 'h':
+    case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(arg, &st) != 0)
+    {
+        return 0;
+    }
+    switch (op)
+    {
+    case 'e': return 1;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'k': return (st.st_mode & S_ISVTX) != 0;
+    case 'O': return st.st_uid == geteuid();
+    default: return st.st_gid == getegid(); // -G
+    }
+}
+
+static int test_primary(test_state *t)
+{
+    if (t->pos >= t->end)
+    {
+        t->err = "argument expected";
+        return 0;
+    }
+    char *arg = t->argv[t->pos];
+
+    // a binary operator in the middle wins over everything, so "test ! = !" compares two !'s
+    if (t->pos + 2 < t->end && is_binary_op(t->argv[t->pos + 1]))
+    {
+        t->pos += 3;
+        return test_binary(t, arg, t->argv[t->pos - 2], t->argv[t->pos - 1]);
+    }
+    if (!strcmp(arg, "("))
+    {
+        t->pos++;
+        int value = test_or(t);
+        if (t->pos >= t->end || strcmp(t->argv[t->pos], ")"))
+        {
+            if (t->err == NULL)
+            {
+                t->err = "')' expected";
+            }
+            return 0;
+        }
+        t->pos++;
+        return value;
+    }
+    if (arg[0] == '-' && arg[1] != '\0' && arg[2] == '\0' && strchr("nztrwxhLefbdcpSsugkOG", arg[1]) != NULL &&
+        t->pos + 1 < t->end)
+    {
+        t->pos += 2;
+        return test_unary(t, arg[1], t->argv[t->pos - 1]);
+    }
+    t->pos++;
+    return arg[0] != '\0';
+}
+
+static int test_not(test_state *t)
+{
+    if (t->pos + 1 < t->end && !strcmp(t->argv[t->pos], "!"))
+    {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static int test_and(test_state *t)
+{
+    int value = test_not(t);
+    while (t->pos < t->end && !strcmp(t->argv[t->pos], "-a"))
+    {
+        t->pos++;
+        value = test_not(t) && value; // both sides get parsed either way
+    }
+    return value;
+}
+
+static int test_or(test_state *t)
+{
+    int value = test_and(t);
+    while (t->pos < t->end && !strcmp(t->argv[t->pos], "-o"))
+    {
+        t->pos++;
+        value = test_and(t) || value;
+    }
+    return value;
+}
+
+static int test_builtin(char **argv)
+{
+    test_state t;
+    t.argv = argv;
+    t.pos = 1;
+    t.end = 0;
+    t.err = NULL;
+    while (argv[t.end] != NULL)
+    {
+        t.end++;
+    }
+    if (!strcmp(argv[0], "["))
+    {
+        if (strcmp(argv[t.end - 1], "]"))
+        {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        t.end--;
+    }
+
+    if (t.pos == t.end)
+    {
+        return 1; // no expression at all is false
+    }
+    int value = test_or(&t);
+    if (t.err == NULL && t.pos < t.end)
+    {
+        t.err = "too many arguments";
+    }
+    if (t.err != NULL)
+    {
+        fprintf(stderr, "%s: %s\n", argv[0], t.err);
+        return 2;
+    }
+    return !value;
+}
+
+/*
+    printf format [argument ...]
+    The format is used over and over until every argument has been used, like every other printf.
+*/
+
+typedef struct printf_state
+{
+    char **args; // next argument to hand a conversion
+    int status;  // 1 once an argument didn't make sense for its conversion
+} printf_state;
+
+// the next argument, NULL once they've all been used (a conversion with nothing left gets 0 or "")
+static char *next_arg(printf_state *p)
+{
+    return *(p->args) == NULL ? NULL : *(p->args)++;
+}
+
+// complains about a number that didn't all parse, the part that did is still used
+static void check_number(printf_state *p, char *arg, char *end)
+{
+    if (end == arg || *end != '\0' || errno != 0)
+    {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        p->status = 1;
+    }
+}
+
+// the next argument for %d and friends. 'c (or "c) is the character code of c
+static long long int_arg(printf_state *p, int is_unsigned)
+{
+    char *arg = next_arg(p);
+    if (arg == NULL)
+    {
+        return 0;
+    }
+    if (arg[0] == '\'' || arg[0] == '"')
+    {
+        return (unsigned char)arg[1];
+    }
+    char *end;
+    errno = 0;
+    long long value = is_unsigned ? (long long)strtoull(arg, &end, 0) : strtoll(arg, &end, 0);
+    check_number(p, arg, end);
+    return value;
+}
+
+static double double_arg(printf_state *p)
+{
+    char *arg = next_arg(p);
+    if (arg == NULL)
+    {
+        return 0;
+    }
+    if (arg[0] == '\'' || arg[0] == '"')
+    {
+        return (unsigned char)arg[1];
+    }
+    char *end;
+    errno = 0;
+    double value = strtod(arg, &end);
+    check_number(p, arg, end);
+    return value;
+}
+
+// prints the format once, using up arguments as it goes. Returns 1 to stop printing altogether (\c).
+static int printf_once(printf_state *p, char *format)
+{
+    char *f = format;
+    while (*f != '\0')
+    {
+        if (*f == '\\')
+        {
+            f++;
+            if (put_escape(stdout, &f, 0))
+            {
+                return 1;
+            }
+            continue;
+        }
+        if (*f != '%')
+        {
+            putchar(*f++);
+            continue;
+        }
+        if (f[1] == '%')
+        {
+            putchar('%');
+            f += 2;
+            continue;
+        }
+
+        // copy the conversion (flags, width, precision) into spec, to hand the real printf
+        char spec[64];
+        int n = 0;
+        char *start = f;
+        spec[n++] = *f++;
+        while (*f != '\0' && strchr("-+ #0", *f) != NULL && n < 8)
+        {
+            spec[n++] = *f++;
+        }
+        for (int part = 0; part < 2; part++) // width, then precision
+        {
+            if (part == 1)
+            {
+                if (*f != '.')
+                {
+                    break;
+                }
+                spec[n++] = *f++;
+            }
+            if (*f == '*')
+            {
+                n += snprintf(spec + n, 16, "%d", (int)int_arg(p, 0));
+                f++;
+            }
+            else
+            {
+                while (*f >= '0' && *f <= '9' && n < 40)
+                {
+                    spec[n++] = *f++;
+                }
+            }
+        }
+        while (*f != '\0' && strchr("hlLqjzt", *f) != NULL)
+        {
+            f++; // the arguments are strings, their size is ours to pick
+        }
+
+        char conversion = *f;
+        if (conversion != '\0')
+        {
+            f++;
+        }
+        switch (conversion)
+        {
+        case 'd':
+        case 'i':
+            strcpy(spec + n, "lld");
+            printf(spec, int_arg(p, 0));
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = conversion;
+            spec[n] = '\0';
+            printf(spec, (unsigned long long)int_arg(p, 1));
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            spec[n++] = conversion;
+            spec[n] = '\0';
+            printf(spec, double_arg(p));
+            break;
+        case 'c':
+        case 's':
+        case 'b':
+        {
+            char *arg = next_arg(p);
+            if (arg == NULL)
+            {
+                arg = "";
+            }
+            strcpy(spec + n, "s");
+            if (conversion == 'c')
+            {
+                char first[2] = {arg[0], '\0'};
+                printf(spec, first);
+            }
+            else if (conversion == 's')
+            {
+                printf(spec, arg);
+            }
+            else
+            {
+                // expand the escapes first, the width and precision apply to what they expand to
+                char *expanded;
+                size_t length;
+                FILE *out = open_memstream(&expanded, &length);
+                int stop = put_escaped(out, arg);
+                fclose(out);
+                printf(spec, expanded);
+                free(expanded);
+                if (stop)
+                {
+                    return 1;
+                }
+            }
+            break;
+        }
+        default:
+            fprintf(stderr, "printf: %.*s: invalid conversion\n", (int)(f - start), start);
+            p->status = 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int printf_builtin(char **argv)
+{
+    if (argv[1] == NULL)
+    {
+        fprintf(stderr, "printf: missing format\n");
+        return 1;
+    }
+    printf_state p;
+    p.args = argv + 2;
+    p.status = 0;
+    char **before;
+    do
+    {
+        before = p.args;
+        if (printf_once(&p, argv[1]))
+        {
+            break;
+        }
+    } while (*(p.args) != NULL && p.args != before); // a format with no conversions is printed once
+    return p.status;
+}
+
+/*
+    A pipeline stage that's nothing but a redirect
+*/
+
+#define COPY_CHUNK (1 << 20)
+
+int copy_stage(char **argv)
+{
+    // splice hands the file's pages to the pipe (or the pipe's to the file) inside the kernel, nothing
+    // gets copied through here. It only works with a pipe on one end, and not into a file opened for
+    // append, and says EINVAL when it can't
+    ssize_t n;
+    while ((n = splice(STDIN_FILENO, NULL, STDOUT_FILENO, NULL, COPY_CHUNK, SPLICE_F_MOVE)) > 0)
+    {
+    }
+    if (n == 0)
+    {
+        return 0;
+    }
+    // sendfile reads from a file into anything (the same way), for when there's no pipe at all
+    if (errno == EINVAL || errno == ENOSYS)
+    {
+        while ((n = sendfile(STDOUT_FILENO, STDIN_FILENO, NULL, COPY_CHUNK)) > 0)
+        {
+        }
+        if (n == 0)
+        {
+            return 0;
+        }
+    }
+    // neither, it's read() and write() the old way
+    if (errno == EINVAL || errno == ENOSYS)
+    {
+        static char buf[65536];
+        while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
+        {
+            ssize_t written = 0;
+            ssize_t w;
+            while (written < n && (w = write(STDOUT_FILENO, buf + written, n - written)) > 0)
+            {
+                written += w;
+            }
+            if (written < n)
+            {
+                n = -1;
+                break;
+            }
+        }
+        if (n == 0)
+        {
+            return 0;
+        }
+    }
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+    return 1;
+}
+
+// every utility the shell has its own version of
+static struct
+{
+    char *name;
+    builtin_fn fn;
+} table[] = {
+    {"echo", echo_builtin},
+    {"pwd", pwd_builtin},
+    {"true", true_builtin},
+    {"false", false_builtin},
+    {"test", test_builtin},
+    {"[", test_builtin},
+    {"printf", printf_builtin},
+    {NULL, NULL},
+};
+
+builtin_fn find_builtin(char *name)
+{
+    for (int i = 0; table[i].name != NULL; i++)
+    {
+        if (!strcmp(name, table[i].name))
+        {
+            return table[i].fn;
+        }
+    }
+    return NULL;
+}
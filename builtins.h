@@ -0,0 +1,31 @@
+/*
+    Small utilities the shell runs itself instead of starting a program for them: echo, pwd, true,
+    false, test (and [) and printf. Batch files are mostly made of these, and every one of them used
+    to cost a whole fork and exec to do next to nothing.
+    Each one takes a NULL terminated argv (argv[0] is the command name), writes to stdout/stderr with
+    stdio, and returns the exit status the program it stands in for would have. None of them read stdin.
+    The shell decides where they run: a command on its own runs right in the shell (with its
+    redirections applied to the shell's own stdin/stdout for the duration), one stage of a pipeline
+    gets a fork() but no exec.
+*/
+
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+typedef int (*builtin_fn)(char **argv);
+
+/*
+    Returns the function implementing the named utility, NULL if the shell doesn't have one (so the
+    program has to be run). Only the bare name counts, "/bin/echo" still runs /bin/echo.
+*/
+builtin_fn find_builtin(char *name);
+
+/*
+    What a stage of a pipeline that's only a redirect runs, like "< big.log" in "< big.log | grep a" or
+    "> out" in "grep a log | > out": copies stdin to stdout, which the shell has pointed at the file and
+    the pipe. The data goes from one to the other with splice() (or sendfile()), without ever being read
+    into the process, so it's as fast as the disk. argv[0] is the file name, for errors.
+*/
+int copy_stage(char **argv);
+
+#endif
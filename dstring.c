@@ -1,89 +1,109 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "dstring.h"
 
-void add_end(dstring* string, char c) {
-    // first character, need to allocate memory and track how much memory we have.
-    if (string -> size == 0) {
-        string -> max = 5;
-        string->arr = malloc(sizeof(char) * string -> max);
-    } else if ((string -> size) + 2 == string -> max) {
-        // we're approaching the limits of memory in string -> arr
-        string -> max = (string -> size) * 5;
-        // so increase it, copy the info over into larger array
-        char* temp = malloc(sizeof(char) * string -> max);
-        for (int i = 0; i < string -> size; i++) {
-            temp[i] = string -> arr[i];
-        }
+#define gap_length(string) ((string) -> max - (string) -> size)
+
+// slide the gap so it starts at index. Only the characters between the old and new spot move.
+static void move_gap(dstring* string, int index) {
+    int gap_len = gap_length(string);
+    if (index < string -> gap) {
+        memmove(string -> arr + index + gap_len, string -> arr + index, string -> gap - index);
+    } else if (index > string -> gap) {
+        memmove(string -> arr + string -> gap, string -> arr + string -> gap + gap_len, index - string -> gap);
+    }
+    string -> gap = index;
+}
+
+// make sure there's room for extra more characters, plus one byte so the string can always be terminated
+static void reserve(dstring* string, int extra) {
+    if (gap_length(string) > extra) {
+        return;
+    }
+    int new_max = string -> max;
+    while (new_max - string -> size <= extra) {
+        new_max *= 2; // doubling keeps add_end O(1) amortized
+    }
+    char* new = malloc(sizeof(char) * new_max);
+    int after = string -> size - string -> gap;
+    // text before the gap stays at the front, text after it moves to the new end
+    memcpy(new, string -> arr, string -> gap);
+    memcpy(new + new_max - after, string -> arr + string -> max - after, after);
+    if (string -> arr != string -> small) {
         free(string -> arr);
-        string -> arr = temp;
     }
-    (string -> size)++;
-    // always make sure the array is null terminated
-    string -> arr[(string -> size) - 1] = c;
-    string -> arr[(string -> size)] = '\0';
+    string -> arr = new;
+    string -> max = new_max;
 }
 
-void remove_dstring_index(dstring* string, int index) {
-    if (string -> size <= 0 || index >= string -> size) {
+void init_string(dstring* string) {
+    string -> arr = string -> small;
+    string -> size = 0;
+    string -> max = DSTRING_INLINE;
+    string -> gap = 0;
+}
+
+void insert_at(dstring* string, int index, char c) {
+    if (index < 0 || index > string -> size) {
         return;
     }
-    // going to need a whole new array
-    char* new = malloc(sizeof(char) * string -> size);
-    int i = 0;
-    int j = 0;
-    while (1) {
-        if (i == index) { // skip the index we're removing
-            i++;
-        }
+    reserve(string, 1);
+    move_gap(string, index);
+    string -> arr[(string -> gap)++] = c;
+    (string -> size)++;
+}
 
-        if (i < string -> size) {
-            new[j] = string->arr[i];
-        } else {
-            break;
-        }
-        i++;
-        j++;
+void add_end(dstring* string, char c) {
+    insert_at(string, string -> size, c);
+}
+
+void remove_dstring_index(dstring* string, int index) {
+    if (index < 0 || index >= string -> size) {
+        return;
     }
+    // put the gap just past the char, then widen it over the char. Nothing is copied when deleting
+    // from the same spot as the last edit (backspacing at the end of the line).
+    move_gap(string, index + 1);
+    (string -> gap)--;
     (string -> size)--;
-    free(string->arr);
-    string -> arr = new;
 }
 
 void add_arr_end(dstring* dest, dstring* source) {
     if (source -> size <= 0) {
         return;
     }
-    char* new = malloc(sizeof(char) * (dest -> size + source -> size));
-    int i = 0;
-    // copy dest into the new arr
-    while (i < dest -> size) {
-        new[i] = dest -> arr[i];
-        i++;
-        if (dest -> arr[i] == '\0') { 
-            // don't null terminate in the middle
-            break;
-        }
-    }
-    int j = 0;
-    // copy source into the new array
-    while (j < source -> size) {
-        new[i] = source -> arr[j];
-        j++;
-        i++;
-    } 
-    if (new[i] != '\0') {
-        new[i] = '\0';
-    }
+    reserve(dest, source -> size);
+    move_gap(dest, dest -> size);
+    int after = source -> size - source -> gap;
+    // source's text is on both sides of its gap
+    memcpy(dest -> arr + dest -> gap, source -> arr, source -> gap);
+    memcpy(dest -> arr + dest -> gap + source -> gap, source -> arr + source -> max - after, after);
+    dest -> gap += source -> size;
+    dest -> size += source -> size;
+}
 
-    free(dest->arr);
-    dest -> size = i;
-    dest -> arr = new;
+void copy_string(dstring* dest, char* source) {
+    int length = strlen(source);
+    // keep whatever memory dest already has, just forget what was in it
+    dest -> size = 0;
+    dest -> gap = 0;
+    reserve(dest, length);
+    memcpy(dest -> arr, source, length);
+    dest -> size = length;
+    dest -> gap = length;
 }
 
-void clear_string(dstring* string) {
-    free(string -> arr);
-    string -> size = 0;
-    string -> max = 0;
+char* as_cstring(dstring* string) {
+    move_gap(string, string -> size);
+    // reserve() always leaves at least one byte of gap for this
+    string -> arr[string -> size] = '\0';
+    return string -> arr;
 }
 
+void clear_string(dstring* string) {
+    if (string -> arr != string -> small) {
+        free(string -> arr);
+    }
+    init_string(string);
+}
@@ -3,20 +3,36 @@
     To make reading characters one at a time from the command prompt tolerable. Provides
     adding a char to the end of the string, removing the char at a given index, and 
     "adding" two d_strings together.
+
+    Under the hood it's a gap buffer: the characters live at both ends of arr with the unused memory
+    (the gap) sitting wherever the last edit happened, so typing or deleting at the same spot over and
+    over never moves anything. Short strings fit in the struct itself and never touch the heap, and
+    longer ones double their memory whenever they run out. Because of both of those, arr is NOT a C
+    string -- use as_cstring() to get one -- and a dstring must never be copied by value.
 */
 
 #ifndef DSTRING_H
 #define DSTRING_H
 
+#define DSTRING_INLINE 32 // strings shorter than this live in small
+
 typedef struct d_string {
-    char* arr;
+    char* arr; // either small or heap memory once the string outgrows it
     int size; // currently in use
     int max; // available memory
+    int gap; // index where the gap starts, characters from here on are stored after it
+    char small[DSTRING_INLINE];
 } dstring;
 
-/* Add char c to the end of the given string */
+/* Set up an empty string. Must be called before any other function is used on the string */
+void init_string(dstring* string);
+
+/* Add char c to the end of the string */
 void add_end(dstring* string, char c);
 
+/* Insert char c at the given index of the string, shifting everything after it along */
+void insert_at(dstring* string, int index, char c);
+
 /* Remove the given index from the string */
 void remove_dstring_index(dstring* string, int index);
 
@@ -27,10 +43,19 @@ void remove_dstring_index(dstring* string, int index);
 */
 void add_arr_end(dstring* dest, dstring* source);
 
+/*
+    Replace the contents of the dstring with the given (null terminated) char*
+*/
+void copy_string(dstring* dest, char* source);
+
+/*
+    Returns the string as a null terminated char*. Valid until the next change to the string.
+*/
+char* as_cstring(dstring* string);
+
 /*
     Release memory associated with d_string and reset struct variables
 */
 void clear_string(dstring* string);
 
 #endif
-
@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include "edit_list.h"
+
+// the user rarely edits more than a couple entries per prompt, so a linear scan is plenty
+static int find(elist *edits, int index)
+{
+    for (int i = 0; i < edits->count; i++)
+    {
+        if (edits->indices[i] == index)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void init_edits(elist *edits)
+{
+    edits->indices = NULL;
+    edits->edits = NULL;
+    edits->count = 0;
+    edits->max = 0;
+}
+
+char *view_entry(elist *edits, llist *history, int index)
+{
+    int i = find(edits, index);
+    if (i == -1)
+    {
+        return get(history, index);
+    }
+    return as_cstring(edits->edits[i]);
+}
+
+dstring *edit_entry(elist *edits, llist *history, int index)
+{
+    int i = find(edits, index);
+    if (i != -1)
+    {
+        return edits->edits[i];
+    }
+
+    if (edits->count == edits->max)
+    {
+        edits->max = edits->max == 0 ? 4 : edits->max * 2;
+        edits->indices = realloc(edits->indices, sizeof(int) * edits->max);
+        edits->edits = realloc(edits->edits, sizeof(dstring *) * edits->max);
+    }
+
+    // first write to this entry, so this is the only time it gets copied
+    dstring *copy = malloc(sizeof(dstring));
+    init_string(copy);
+    copy_string(copy, get(history, index));
+
+    edits->indices[edits->count] = index;
+    edits->edits[edits->count] = copy;
+    edits->count++;
+    return copy;
+}
+
+void reset_edits(elist *edits)
+{
+    for (int i = 0; i < edits->count; i++)
+    {
+        clear_string(edits->edits[i]);
+        free(edits->edits[i]);
+    }
+    edits->count = 0;
+}
@@ -0,0 +1,45 @@
+/*
+    Copy-on-write edits of history entries, for use in the shell's prompt loop.
+    Scrolling through history with UP/DOWN only ever reads entries straight out of the history list.
+    An entry is copied into its own dstring the first time the user actually changes it, and from then
+    on that copy is what the prompt shows for the entry. Scrolling past N entries costs nothing.
+    All edits are thrown away once the user presses enter.
+*/
+
+#ifndef EDIT_LIST_H
+#define EDIT_LIST_H
+
+#include "dstring.h"
+#include "linked_list.h"
+
+typedef struct edit_list
+{
+    int *indices;    // history index each edit belongs to
+    dstring **edits; // edited copies, parallel to indices
+    int count;       // number of edited entries
+    int max;         // available memory
+} elist;
+
+/*
+    Set up an empty edit list. Must be called before any other function is used on the list.
+*/
+void init_edits(elist *edits);
+
+/*
+    Returns what the prompt should show for the given history index: the user's edited copy if they
+    have changed that entry, otherwise the entry itself (no copy is made).
+*/
+char *view_entry(elist *edits, llist *history, int index);
+
+/*
+    Returns the editable copy of the given history index, copying the entry out of history the first
+    time it is asked for (copy-on-write).
+*/
+dstring *edit_entry(elist *edits, llist *history, int index);
+
+/*
+    Release every edited copy. The edit list can be reused afterwards.
+*/
+void reset_edits(elist *edits);
+
+#endif
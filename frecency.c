@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frecency.h"
+
+#define is_blank(c) ((c) == ' ' || (c) == '\t' || (c) == '\n')
+
+// FNV-1a of line with the whitespace evened out, without making the evened out copy
+static unsigned int hash_command(char *line)
+{
+    unsigned int h = 2166136261u;
+    int blank = 0;
+    for (line += strspn(line, " \t\n"); *line != '\0'; line++)
+    {
+        if (is_blank(*line))
+        {
+            blank = 1;
+            continue;
+        }
+        if (blank)
+        {
+            h = (h ^ ' ') * 16777619u; // a run of whitespace counts as one space (none at the end)
+            blank = 0;
+        }
+        h = (h ^ (unsigned char)*line) * 16777619u;
+    }
+    return h;
+}
+
+// 1 if line with its whitespace evened out is command, 0 otherwise
+static int same_command(char *command, char *line)
+{
+    for (line += strspn(line, " \t\n"); *line != '\0'; line++)
+    {
+        if (is_blank(*line))
+        {
+            line += strspn(line, " \t\n") - 1;
+            if (line[1] == '\0')
+            {
+                break;
+            }
+            if (*command++ != ' ')
+            {
+                return 0;
+            }
+        }
+        else if (*command++ != *line)
+        {
+            return 0;
+        }
+    }
+    return *command == '\0';
+}
+
+// malloc'd copy of line with the whitespace evened out
+static char *even_out(char *line)
+{
+    char *command = malloc(strlen(line) + 1);
+    int length = 0;
+    for (line += strspn(line, " \t\n"); *line != '\0'; line++)
+    {
+        if (is_blank(*line))
+        {
+            line += strspn(line, " \t\n") - 1;
+            if (line[1] != '\0')
+            {
+                command[length++] = ' ';
+            }
+        }
+        else
+        {
+            command[length++] = *line;
+        }
+    }
+    command[length] = '\0';
+    return command;
+}
+
+// slot holding line's record, or the empty slot it would go in
+static int probe(cstats *c, char *line, unsigned int hash)
+{
+    int i = hash & (c->max - 1);
+    while (c->records[i].command != NULL && (c->records[i].hash != hash || !same_command(c->records[i].command, line)))
+    {
+        i = (i + 1) & (c->max - 1);
+    }
+    return i;
+}
+
+// double the table, keeping it at most half full
+static void grow(cstats *c)
+{
+    crecord *old = c->records;
+    int old_max = c->max;
+    c->max = old_max == 0 ? 64 : old_max * 2;
+    c->records = calloc(c->max, sizeof(crecord));
+    for (int i = 0; i < old_max; i++)
+    {
+        if (old[i].command != NULL)
+        {
+            int j = old[i].hash & (c->max - 1);
+            while (c->records[j].command != NULL)
+            {
+                j = (j + 1) & (c->max - 1);
+            }
+            c->records[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+// line's record, a new empty one if it's never been seen
+static crecord *record_of(cstats *c, char *line)
+{
+    if (2 * (c->count + 1) > c->max)
+    {
+        grow(c);
+    }
+    unsigned int hash = hash_command(line);
+    crecord *r = &(c->records[probe(c, line, hash)]);
+    if (r->command == NULL)
+    {
+        memset(r, 0, sizeof(crecord));
+        r->command = even_out(line);
+        r->hash = hash;
+        c->count++;
+    }
+    return r;
+}
+
+// line's record, NULL if it isn't in the table
+static crecord *find_record(cstats *c, char *line)
+{
+    if (c->max == 0)
+    {
+        return NULL;
+    }
+    crecord *r = &(c->records[probe(c, line, hash_command(line))]);
+    return r->command == NULL ? NULL : r;
+}
+
+// run often and recently: runs, less the longer it's been since the last one
+static double frecency(crecord *r, time_t now)
+{
+    double hours = difftime(now, r->last_run) / 3600;
+    return r->runs / (1 + (hours > 0 ? hours : 0));
+}
+
+void init_command_stats(cstats *c)
+{
+    c->records = NULL;
+    c->count = 0;
+    c->max = 0;
+    c->started = time(NULL);
+}
+
+void command_added(cstats *c, char *line)
+{
+    record_of(c, line)->copies++;
+}
+
+void command_removed(cstats *c, char *line)
+{
+    if (c->max == 0)
+    {
+        return;
+    }
+    int i = probe(c, line, hash_command(line));
+    if (c->records[i].command == NULL || --(c->records[i].copies) > 0)
+    {
+        return;
+    }
+    free(c->records[i].command);
+    c->records[i].command = NULL;
+    c->count--;
+    // put back everything after the hole up to the next empty slot, some of it may have probed past it.
+    // An evened out command evens out to itself, so it can be probed for as is
+    for (int j = (i + 1) & (c->max - 1); c->records[j].command != NULL; j = (j + 1) & (c->max - 1))
+    {
+        crecord moved = c->records[j];
+        c->records[j].command = NULL;
+        c->records[probe(c, moved.command, moved.hash)] = moved;
+    }
+}
+
+void command_ran(cstats *c, char *line, int seq)
+{
+    crecord *r = record_of(c, line);
+    r->runs++;
+    r->last_seq = seq;
+    r->last_run = time(NULL);
+}
+
+void command_loaded(cstats *c, char *line, int seq)
+{
+    crecord *r = record_of(c, line);
+    r->copies++;
+    if (r->runs++ == 0)
+    {
+        // the newest copy there is, a run this session would already have counted and be newer still
+        r->last_seq = seq;
+        r->last_run = c->started;
+    }
+}
+
+void command_finished(cstats *c, char *line, run_stats *stats)
+{
+    crecord *r = find_record(c, line);
+    if (r == NULL)
+    {
+        return;
+    }
+    r->finished++;
+    r->last_status = stats->status;
+    r->total_ns += stats->wall_ns;
+}
+
+char *frecent_prefix(cstats *c, char *prefix)
+{
+    time_t now = time(NULL);
+    int length = strlen(prefix);
+    crecord *best = NULL;
+    double best_score = 0;
+    for (int i = 0; i < c->max; i++)
+    {
+        crecord *r = &(c->records[i]);
+        if (r->command == NULL || r->runs == 0 || strncmp(r->command, prefix, length))
+        {
+            continue;
+        }
+        double score = frecency(r, now);
+        if (best == NULL || score > best_score || (score == best_score && r->last_seq > best->last_seq))
+        {
+            best = r;
+            best_score = score;
+        }
+    }
+    return best == NULL ? NULL : best->command;
+}
+
+typedef struct ranked
+{
+    double score;
+    int index;
+} ranked;
+
+// most frecent first, then newest first
+static int compare_ranked(const void *a, const void *b)
+{
+    const ranked *x = a, *y = b;
+    if (x->score != y->score)
+    {
+        return x->score < y->score ? 1 : -1;
+    }
+    return y->index - x->index;
+}
+
+int frecent_order(cstats *c, llist *history, int **order)
+{
+    time_t now = time(NULL);
+    ranked *ranks = malloc(sizeof(ranked) * (c->count + 1));
+    int count = 0;
+    for (int i = 0; i < c->max; i++)
+    {
+        crecord *r = &(c->records[i]);
+        int index;
+        if (r->command != NULL && r->runs > 0 && (index = seq_index(history, r->last_seq)) != -1)
+        {
+            ranks[count].score = frecency(r, now);
+            ranks[count].index = index;
+            count++;
+        }
+    }
+    qsort(ranks, count, sizeof(ranked), compare_ranked);
+    *order = malloc(sizeof(int) * (count + 1));
+    for (int i = 0; i < count; i++)
+    {
+        (*order)[i] = ranks[i].index;
+    }
+    free(ranks);
+    return count;
+}
+
+// most time spent first
+static int compare_total(const void *a, const void *b)
+{
+    const crecord *x = *(crecord **)a, *y = *(crecord **)b;
+    return x->total_ns < y->total_ns ? 1 : x->total_ns > y->total_ns ? -1 : 0;
+}
+
+void print_top(cstats *c, int n)
+{
+    crecord **heaviest = malloc(sizeof(crecord *) * (c->count + 1));
+    int count = 0;
+    for (int i = 0; i < c->max; i++)
+    {
+        if (c->records[i].command != NULL && c->records[i].finished > 0)
+        {
+            heaviest[count++] = &(c->records[i]);
+        }
+    }
+    qsort(heaviest, count, sizeof(crecord *), compare_total);
+    printf("%10s %6s %10s %6s  %s\n", "total", "runs", "mean", "exit", "command");
+    for (int i = 0; i < count && i < n; i++)
+    {
+        crecord *r = heaviest[i];
+        printf("%9.3fs %6d %9.3fs %6d  %s\n", r->total_ns / 1e9, r->runs, r->total_ns / 1e9 / r->finished,
+               r->last_status, r->command);
+    }
+    free(heaviest);
+}
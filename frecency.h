@@ -0,0 +1,78 @@
+/*
+    What each different command has cost over time: how many times it was run, when it was last run,
+    the wall time of every run added up and how the last one exited.
+    Commands are told apart by their text with the whitespace evened out ("ls  -l " is "ls -l"), and
+    kept in one open addressing hash table keyed by that text, so a command run a thousand times is one
+    record, not a thousand history entries.
+    A record lasts as long as the command is somewhere in the history. When the last entry holding it is
+    dropped (TWOSHELL_HISTSIZE), so is the record, so a capped history keeps the table capped too. A
+    command that comes back after that starts counting again from scratch.
+    The history keeps it up to date (see track_commands in linked_list.h). Commands already in the
+    history when the table's started (loaded from the history file) are added a chunk at a time while
+    the prompt waits for keys, each entry counting as one run. When it really ran isn't known, so they
+    all count as having run when the table was set up. It's what "history --top" lists, and what auto-complete and the up arrow go by when TWOSHELL_FRECENCY is set: the commands
+    run most often, most recently, come first.
+*/
+
+#ifndef FRECENCY_H
+#define FRECENCY_H
+
+#include <time.h>
+#include "linked_list.h"
+
+typedef struct command_record
+{
+    char *command;      // with the whitespace evened out. NULL marks an empty slot
+    unsigned int hash;  // of command
+    int copies;         // history entries holding it, the record goes when the last of them does
+    int runs;           // times it was run
+    int finished;       // runs the shell saw finish (and timed)
+    int last_status;    // exit status of the last run that finished
+    int last_seq;       // history sequence number (see entry_seq) of the last run
+    time_t last_run;    // when it was last run
+    long long total_ns; // wall time of every run that finished, added up
+} crecord;
+
+typedef struct command_stats
+{
+    crecord *records; // the hash table
+    int count;        // slots in use
+    int max;          // slots, always 0 or a power of two
+    time_t started;   // when the table was set up, which is when loaded runs count as having run
+} cstats;
+
+/* Set up an empty table */
+void init_command_stats(cstats *c);
+
+/* A history entry holding the given command line was added/removed */
+void command_added(cstats *c, char *line);
+void command_removed(cstats *c, char *line);
+
+/* The given command line was just run, and is the history entry with sequence number seq */
+void command_ran(cstats *c, char *line, int seq);
+
+/*
+    A history entry from before the table was started, holding the given command line and with sequence
+    number seq, counts as a run. They're expected newest first (see track_entries in linked_list.h).
+*/
+void command_loaded(cstats *c, char *line, int seq);
+
+/* The given command line finished, costing stats. Ignored if the command isn't in the history any more. */
+void command_finished(cstats *c, char *line, run_stats *stats);
+
+/*
+    The command starting with prefix that was run most often, most recently. NULL if there isn't one.
+    Looks at every different command, so it's O(number of different commands).
+*/
+char *frecent_prefix(cstats *c, char *prefix);
+
+/*
+    Sets *order to a malloc'd array of history indices, the newest entry of each different command still
+    in the history, the most frecent first. Returns how many there are.
+*/
+int frecent_order(cstats *c, llist *history, int **order);
+
+/* Print the n commands with the most wall time spent running them, heaviest first ("history --top") */
+void print_top(cstats *c, int n);
+
+#endif
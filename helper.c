@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <poll.h>
+#include <unistd.h>
 #include "helper.h"
 
 /*EVERYTHING FROM HERE*/
@@ -13,6 +15,8 @@ void initTermios(int echo)
     tcgetattr(0, &old);         /* grab old terminal i/o settings */
     current = old;              /* make new settings same as old settings */
     current.c_lflag &= ~ICANON; /* disable buffered i/o */
+    current.c_cc[VMIN] = 1;     /* read() waits for at least one byte... */
+    current.c_cc[VTIME] = 0;    /* ...for as long as it takes */
     if (echo)
     {
         current.c_lflag |= ECHO; /* set echo mode */
@@ -30,29 +34,142 @@ void resetTermios(void)
     tcsetattr(0, TCSANOW, &old);
 }
 
-/* Read 1 character - echo defines echo mode */
-char getch_(int echo)
+/* TO HERE IS SHAMELESSY STOLEN - I miss Java KeyListeners */
+
+void init_keys(keyreader *keys)
 {
-    char ch;
-    initTermios(echo);
-    ch = getchar();
-    resetTermios();
-    return ch;
+    keys->pos = 0;
+    keys->len = 0;
 }
 
-/* Read 1 character without echo */
-char getch(void)
+// read whatever the terminal has for us onto the end of the buffer. If wait_ms isn't -1, give up
+// (returning 0) when nothing shows up in that long.
+static int fill_keys(keyreader *keys, int wait_ms)
 {
-    return getch_(0);
+    if (keys->pos == keys->len)
+    {
+        keys->pos = 0;
+        keys->len = 0;
+    }
+    else if (keys->len == KEY_BUFFER_SIZE)
+    {
+        // a partial escape sequence is stuck at the end of a full buffer, make room in front of it
+        memmove(keys->buf, keys->buf + keys->pos, keys->len - keys->pos);
+        keys->len -= keys->pos;
+        keys->pos = 0;
+    }
+    if (wait_ms != -1)
+    {
+        struct pollfd in = {0, POLLIN, 0};
+        if (poll(&in, 1, wait_ms) <= 0)
+        {
+            return 0;
+        }
+    }
+    fflush(stdout); // everything echoed for the last batch goes out before we block
+    ssize_t n = read(0, keys->buf + keys->len, KEY_BUFFER_SIZE - keys->len);
+    if (n <= 0)
+    {
+        return 0;
+    }
+    keys->len += n;
+    return n;
 }
 
-/* Read 1 character with echo */
-char getche(void)
+// byte at pos + offset, reading more if a sequence was split across reads. -1 if it never arrives.
+static int peek_key(keyreader *keys, int offset)
 {
-    return getch_(1);
+    // the rest of an escape sequence comes in the same burst, so don't wait long for it. Any
+    // longer and it was the escape key on its own.
+    while (keys->pos + offset >= keys->len)
+    {
+        if (!fill_keys(keys, 50))
+        {
+            return -1;
+        }
+    }
+    return keys->buf[keys->pos + offset];
 }
 
-/* TO HERE IS SHAMELESSY STOLEN - I miss Java KeyListeners */
+int next_key(keyreader *keys)
+{
+    if (keys->pos == keys->len && !fill_keys(keys, -1))
+    {
+        return KEY_EOF;
+    }
+    int c = keys->buf[keys->pos];
+    if (c != '\033')
+    {
+        keys->pos++;
+        return c;
+    }
+
+    int kind = peek_key(keys, 1);
+    if (kind != '[' && kind != 'O')
+    {
+        keys->pos++;
+        return KEY_ESCAPE;
+    }
+    // ESC [ <parameters> <final byte>, parameters are digits and ';'
+    int length = 2;
+    int param = 0;
+    int final;
+    while ((final = peek_key(keys, length)) != -1 && ((final >= '0' && final <= '9') || final == ';'))
+    {
+        if (final != ';')
+        {
+            param = param * 10 + (final - '0');
+        }
+        length++;
+    }
+    if (final == -1)
+    {
+        // sequence got cut off, hand back the escape and let the rest come through as characters
+        keys->pos++;
+        return KEY_ESCAPE;
+    }
+    keys->pos += length + 1;
+
+    switch (final)
+    {
+    case 'A':
+        return KEY_UP;
+    case 'B':
+        return KEY_DOWN;
+    case 'C':
+        return KEY_RIGHT;
+    case 'D':
+        return KEY_LEFT;
+    case 'H':
+        return KEY_HOME;
+    case 'F':
+        return KEY_END;
+    case '~': // ESC [ n ~
+        switch (param)
+        {
+        case 1:
+        case 7:
+            return KEY_HOME;
+        case 3:
+            return KEY_DELETE;
+        case 4:
+        case 8:
+            return KEY_END;
+        }
+    }
+    return KEY_UNKNOWN;
+}
+
+int key_waiting(keyreader *keys)
+{
+    if (keys->pos < keys->len)
+    {
+        return 1;
+    }
+    fflush(stdout);
+    struct pollfd in = {0, POLLIN, 0};
+    return poll(&in, 1, 0) > 0;
+}
 
 int starts_with(char *line, char looking_for)
 {
@@ -72,7 +189,7 @@ int starts_with(char *line, char looking_for)
 char *clean_string(char *source, int length)
 {
     int i = 0;
-    while (source[i] == ' ') // skip all leading spaces
+    while (i < length && source[i] == ' ') // skip all leading spaces
     {
         i++;
     }
@@ -82,6 +199,7 @@ char *clean_string(char *source, int length)
     {
         cleaned[j] = source[i + j];
     }
+    cleaned[length - i] = '\0';
 
     return cleaned;
 }
@@ -95,9 +213,10 @@ void copy_arr(char **source, char ***dest, int start, int end)
     *dest = malloc(((end - start) + 1) * sizeof(char *));
     for (int i = 0; i + start < end; i++)
     {
-        (*dest)[i] = malloc(sizeof(char *));
+        (*dest)[i] = malloc(strlen(source[i + start]) + 1);
         strcpy((*dest)[i], source[i + start]);
     }
+    (*dest)[end - start] = NULL;
 }
 
 
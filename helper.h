@@ -4,24 +4,48 @@
 
 #ifndef HELPER_H
 #define HELPER_H
-#include <termios.h>
 
-static struct termios old, current;
-
-/* Initialize new terminal i/o settings. author -niko */
+/* Initialize new terminal i/o settings. author -niko
+   The prompt calls this once per command (not once per key) and reads keys with next_key() until
+   the user presses enter. */
 void initTermios(int echo);
 
 /* Restore old terminal i/o settings. author -niko */
 void resetTermios(void);
 
-/* Read 1 character - echo defines echo mode. author -niko */
-char getch_(int echo);
-
-/* Read 1 character without echo. author -niko */
-char getch(void);
-
-/* Read 1 character with echo. author -niko */
-char getche(void);
+/* Keys next_key() returns on top of plain characters (which are returned as themselves, 0-255) */
+#define KEY_EOF -1      // stdin is closed
+#define KEY_UP 0x100
+#define KEY_DOWN 0x101
+#define KEY_RIGHT 0x102
+#define KEY_LEFT 0x103
+#define KEY_HOME 0x104
+#define KEY_END 0x105
+#define KEY_DELETE 0x106 // the delete key, not backspace (that's a plain 127)
+#define KEY_ESCAPE 0x107 // escape on its own
+#define KEY_UNKNOWN 0x108 // some escape sequence we don't handle, already swallowed whole
+
+#define KEY_BUFFER_SIZE 4096
+
+typedef struct key_reader
+{
+    unsigned char buf[KEY_BUFFER_SIZE]; // bytes read from the terminal but not handed out yet
+    int pos; // next byte to decode
+    int len; // bytes of buf in use
+} keyreader;
+
+/* Set up an empty key reader */
+void init_keys(keyreader *keys);
+
+/* Returns the next key from stdin, decoding escape sequences (arrow keys etc.) into a single KEY_ value.
+   When everything read so far has been handed out, stdout is flushed and everything the terminal has
+   waiting is read with one read(), so a paste of any size costs one syscall rather than one per char. */
+int next_key(keyreader *keys);
+
+/* Returns 1 if next_key() has a key to hand out straight away, 0 if it would have to wait for one.
+   Flushes stdout like next_key() does before it waits, so the screen is up to date while the caller
+   gets on with something else. */
+int key_waiting(keyreader *keys);
 
 /* Returns a 1 if the given string starts with that char looking_for, 0 otherwise*/
 int starts_with(char *line, char looking_for);
@@ -0,0 +1,124 @@
+#define _GNU_SOURCE // memrchr
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "history_file.h"
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0 // linux only, just a prefault hint
+#endif
+
+static char *history_err_msg = "history file error";
+
+// offset into the file of the first of its last limit lines. Only the end of the file gets looked at.
+static off_t tail_offset(int fd, off_t size, int limit)
+{
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return 0;
+    }
+    char *p = map + size;
+    if (p[-1] == '\n')
+    {
+        p--; // the last line's own line break
+    }
+    for (int n = 0; n < limit && p != NULL; n++)
+    {
+        p = memrchr(map, '\n', p - map);
+    }
+    off_t offset = p == NULL ? 0 : (p + 1) - map;
+    munmap(map, size);
+    return offset;
+}
+
+int open_history(hfile *file, char *path, llist *history)
+{
+    file->map = NULL;
+    file->map_len = 0;
+    file->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (file->fd == -1)
+    {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(file->fd, &st) == -1 || st.st_size == 0)
+    {
+        return 1; // nothing to load
+    }
+
+    // with a capped history, only the lines that are going to be kept are worth mapping. Mappings start on
+    // a page boundary, so back up to the one before the first line we want.
+    off_t first = history->limit > 0 ? tail_offset(file->fd, st.st_size, history->limit) : 0;
+    off_t from = first - first % sysconf(_SC_PAGESIZE);
+
+    // private and writable, so the line breaks can be turned into terminators without touching the file.
+    // Every page is about to be written, so fault them all in up front rather than one at a time.
+    char *map = mmap(NULL, st.st_size - from, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, file->fd, from);
+    if (map == MAP_FAILED)
+    {
+        perror(history_err_msg);
+        return 1;
+    }
+    file->map = map;
+    file->map_len = st.st_size - from;
+
+    char *end = map + file->map_len;
+    char *line = map + (first - from);
+    char *newline;
+    while (line < end && (newline = memchr(line, '\n', end - line)) != NULL)
+    {
+        *newline = '\0';
+        if (newline != line) // skip blank lines
+        {
+            add_last_ref(history, line);
+        }
+        line = newline + 1;
+    }
+    if (line < end)
+    {
+        // last line has no line break to terminate it with (and there may be no room past it in the
+        // mapping), so this one gets copied
+        char *last = malloc((end - line) + 1);
+        memcpy(last, line, end - line);
+        last[end - line] = '\0';
+        add_last(history, last);
+    }
+    return 1;
+}
+
+void append_history(hfile *file, char *command)
+{
+    if (file->fd == -1)
+    {
+        return;
+    }
+    // the command and its line break in one write, so with O_APPEND a line never gets split up by
+    // another shell appending at the same time
+    struct iovec line[2] = {{command, strlen(command)}, {"\n", 1}};
+    if (writev(file->fd, line, 2) != (ssize_t)(line[0].iov_len + 1))
+    {
+        perror(history_err_msg);
+    }
+}
+
+void close_history(hfile *file)
+{
+    if (file->map != NULL)
+    {
+        munmap(file->map, file->map_len);
+        file->map = NULL;
+    }
+    if (file->fd != -1)
+    {
+        close(file->fd);
+        file->fd = -1;
+    }
+}
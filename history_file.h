@@ -0,0 +1,41 @@
+/*
+    Persistent history for the shell, kept in ~/.twoshell_history (one command per line).
+    At startup the file is memory mapped and the history list is pointed straight at each line in the
+    mapping, so there's one pass to find the line breaks and no per-line allocation no matter how long
+    the history is. Commands run afterwards are appended as they're entered, one write() each, so a
+    shell that's killed or loses its terminal doesn't take the session's history with it.
+*/
+
+#ifndef HISTORY_FILE_H
+#define HISTORY_FILE_H
+
+#include <stddef.h>
+#include "linked_list.h"
+
+#define HISTORY_FILE_NAME ".twoshell_history"
+
+typedef struct history_file
+{
+    int fd;                        // history file, opened for appending. -1 if it couldn't be opened
+    char *map;                     // the file as it was at startup, entries in the history list point in here
+    size_t map_len;                // length of map
+} hfile;
+
+/*
+    Open (creating if needed) the history file at path and add every line in it to the end of history.
+    Returns 1 if the file could be opened, 0 otherwise. The shell works fine without one.
+*/
+int open_history(hfile *file, char *path, llist *history);
+
+/*
+    Append the given command to the history file.
+*/
+void append_history(hfile *file, char *command);
+
+/*
+    Close the history file. Entries loaded from it are only valid while the history file is
+    open, so close it after the history list is done with.
+*/
+void close_history(hfile *file);
+
+#endif
@@ -0,0 +1,617 @@
+#define _GNU_SOURCE // memfd_create
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h> // memfd_create
+#include <sys/resource.h> // rusage
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "jobs.h"
+#include "trace.h"
+
+static job *jobs = NULL; // slots with id 0 are free
+static int jobs_max = 0;
+static int job_control = 0;
+static pid_t shell_pgid = 0;
+// between capture_output and attach_output: the buffers, and where stdout/stderr really go
+static int capture_out = -1, capture_err = -1;
+static int saved_out = -1, saved_err = -1;
+
+static char *no_job_err_msg = "no such job";
+static char *capture_err_msg = "couldn't buffer output";
+
+static long long timeval_us(struct timeval tv)
+{
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// a wait status for process k of the job came back, update its state and the job's totals
+static void update_process(job *j, int k, int status, struct rusage *usage)
+{
+    if (WIFSTOPPED(status))
+    {
+        j->states[k] = PROC_STOPPED;
+        return;
+    }
+    if (WIFCONTINUED(status))
+    {
+        j->states[k] = PROC_RUNNING;
+        return;
+    }
+    j->states[k] = PROC_DONE;
+    // the shell waiting on its foreground job, or the handler picking up after a background one
+    trace_event(j->foreground ? TRACE_WAIT : TRACE_REAP, j->pids[k],
+                WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status), 0, NULL);
+    // clock_gettime is safe in a signal handler, so this is when the process really exited, not when
+    // somebody got round to looking. The last one to exit sets the job's wall time.
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    j->stats.wall_ns = (now.tv_sec - j->started.tv_sec) * 1000000000LL + (now.tv_nsec - j->started.tv_nsec);
+    j->stats.user_us += timeval_us(usage->ru_utime);
+    j->stats.sys_us += timeval_us(usage->ru_stime);
+    if (usage->ru_maxrss > j->stats.max_rss_kb)
+    {
+        j->stats.max_rss_kb = usage->ru_maxrss;
+    }
+    if (k == j->count - 1) // a pipeline's status is its last command's
+    {
+        j->stats.status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+    }
+}
+
+// collect every wait status the job's processes have waiting, without blocking. Only waits on the
+// job's own pids, so nobody else's children get reaped by mistake.
+static void poll_job(job *j)
+{
+    for (int k = 0; k < j->count; k++)
+    {
+        int status;
+        struct rusage usage;
+        while (j->states[k] != PROC_DONE &&
+               wait4(j->pids[k], &status, WNOHANG | WUNTRACED | WCONTINUED, &usage) > 0)
+        {
+            update_process(j, k, status, &usage);
+        }
+    }
+}
+
+// only touches the job table (which main only changes with SIGCHLD blocked) and wait4, both safe here
+static void sigchld_handler(int signo)
+{
+    int saved_errno = errno;
+    for (int i = 0; i < jobs_max; i++)
+    {
+        // the shell is already waiting on the foreground job itself
+        if (jobs[i].id != 0 && !jobs[i].foreground)
+        {
+            poll_job(&jobs[i]);
+        }
+    }
+    errno = saved_errno;
+}
+
+static int job_done(job *j)
+{
+    for (int k = 0; k < j->count; k++)
+    {
+        if (j->states[k] != PROC_DONE)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int job_stopped(job *j)
+{
+    int stopped = 0;
+    for (int k = 0; k < j->count; k++)
+    {
+        if (j->states[k] == PROC_RUNNING)
+        {
+            return 0;
+        }
+        stopped |= j->states[k] == PROC_STOPPED;
+    }
+    return stopped;
+}
+
+static void free_job(job *j)
+{
+    free(j->pids);
+    free(j->states);
+    free(j->command);
+    if (j->out_fd != -1)
+    {
+        close(j->out_fd);
+        close(j->err_fd);
+    }
+    j->id = 0;
+}
+
+// copy everything written to the buffer (from the start) to the given fd
+static void copy_buffer(int from, int to)
+{
+    char buf[65536];
+    ssize_t n;
+    lseek(from, 0, SEEK_SET);
+    while ((n = read(from, buf, sizeof(buf))) > 0)
+    {
+        for (ssize_t done = 0, w; done < n; done += w)
+        {
+            if ((w = write(to, buf + done, n - done)) == -1)
+            {
+                return;
+            }
+        }
+    }
+}
+
+// the buffered job that was started first, NULL if there aren't any
+static job *first_buffered(void)
+{
+    job *first = NULL;
+    for (int i = 0; i < jobs_max; i++)
+    {
+        if (jobs[i].id != 0 && jobs[i].out_fd != -1 &&
+            (first == NULL || jobs[i].history_seq < first->history_seq))
+        {
+            first = &jobs[i];
+        }
+    }
+    return first;
+}
+
+// "%n", "n", or NULL for the most recent job (the most recent stopped one, if only_stopped is set)
+static job *find_job(char *spec, int only_stopped)
+{
+    if (spec != NULL)
+    {
+        int id = atoi(spec[0] == '%' ? spec + 1 : spec);
+        for (int i = 0; i < jobs_max; i++)
+        {
+            if (id > 0 && jobs[i].id == id)
+            {
+                return &jobs[i];
+            }
+        }
+        return NULL;
+    }
+    job *latest = NULL;
+    for (int i = 0; i < jobs_max; i++)
+    {
+        if (jobs[i].id != 0 && (!only_stopped || job_stopped(&jobs[i])) &&
+            (latest == NULL || jobs[i].id > latest->id))
+        {
+            latest = &jobs[i];
+        }
+    }
+    return latest;
+}
+
+static void record_job(job *j, llist *history)
+{
+    j->stats.recorded = 1;
+    if (history != NULL && j->history_seq != -1)
+    {
+        set_stats(history, seq_index(history, j->history_seq), &(j->stats));
+    }
+}
+
+// SIGCHLD has to be blocked when this is called. Waits on each of the job's exact pids until they've
+// all exited or one of them stops.
+static int wait_foreground(job *j, llist *history, run_stats *stats)
+{
+    j->foreground = 1;
+    if (job_control && j->pgid > 0)
+    {
+        tcsetpgrp(STDIN_FILENO, j->pgid);
+    }
+    // background jobs keep getting reaped while we wait, the handler leaves this one alone
+    unblock_sigchld();
+
+    int stopped = 0;
+    for (int k = 0; k < j->count && !stopped; k++)
+    {
+        while (j->states[k] == PROC_RUNNING)
+        {
+            int status;
+            struct rusage usage;
+            if (wait4(j->pids[k], &status, WUNTRACED, &usage) == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                j->states[k] = PROC_DONE; // somehow not ours to wait on any more
+                break;
+            }
+            update_process(j, k, status, &usage);
+            stopped = j->states[k] == PROC_STOPPED;
+        }
+    }
+
+    block_sigchld();
+    if (job_control)
+    {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+    }
+    j->foreground = 0;
+    if (stopped)
+    {
+        // the rest of the pipeline got the same CTRL-Z, pick up whatever they've reported so far.
+        // Anything later comes in through the handler.
+        poll_job(j);
+        j->reported = 1;
+        printf("\n[%d]+  Stopped                 %s\n", j->id, j->command);
+        unblock_sigchld();
+        return 0;
+    }
+    record_job(j, history);
+    if (stats != NULL)
+    {
+        *stats = j->stats;
+    }
+    free_job(j);
+    unblock_sigchld();
+    return 1;
+}
+
+void init_jobs(int control)
+{
+    job_control = control;
+    if (job_control)
+    {
+        // the shell stays out of the way of CTRL-Z and background reads/writes, those are for its jobs
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN);
+        setpgid(0, 0); // fails if we're already a session leader, in which case we have our own group anyway
+        shell_pgid = getpgrp();
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sigchld_handler;
+    sigemptyset(&action.sa_mask);
+    // no SA_NOCLDSTOP, stopped/continued background jobs are worth hearing about too
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &action, NULL);
+}
+
+int job_control_on(void)
+{
+    return job_control;
+}
+
+void block_sigchld(void)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+}
+
+void unblock_sigchld(void)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
+}
+
+int add_job(struct command commands[], int command_count, char *command, int foreground, int history_seq,
+            struct timespec *started)
+{
+    job *j = NULL;
+    int id = 1;
+    for (int i = 0; i < jobs_max; i++)
+    {
+        if (jobs[i].id == 0 && j == NULL)
+        {
+            j = &jobs[i];
+        }
+        if (jobs[i].id >= id)
+        {
+            id = jobs[i].id + 1;
+        }
+    }
+    if (j == NULL)
+    {
+        // safe to move the table, the handler can't run while SIGCHLD is blocked
+        int new_max = jobs_max == 0 ? 8 : jobs_max * 2;
+        jobs = realloc(jobs, sizeof(job) * new_max);
+        for (int i = jobs_max; i < new_max; i++)
+        {
+            jobs[i].id = 0;
+        }
+        j = &jobs[jobs_max];
+        jobs_max = new_max;
+    }
+
+    j->pids = malloc(sizeof(pid_t) * command_count);
+    j->states = malloc(sizeof(int) * command_count);
+    j->count = command_count;
+    j->pgid = 0;
+    j->stats.recorded = 0;
+    j->stats.status = 0;
+    j->stats.user_us = 0;
+    j->stats.sys_us = 0;
+    j->stats.max_rss_kb = 0;
+    j->stats.wall_ns = 0;
+    for (int k = 0; k < command_count; k++)
+    {
+        j->pids[k] = commands[k].pid;
+        // a stage that never started is as good as done, with bash's command not found status
+        j->states[k] = commands[k].pid == -1 ? PROC_DONE : PROC_RUNNING;
+        if (commands[k].pid == -1 && k == command_count - 1)
+        {
+            j->stats.status = 127;
+        }
+        if (job_control && j->pgid == 0 && commands[k].pid != -1)
+        {
+            j->pgid = commands[k].pid; // the first stage that started leads the group
+        }
+    }
+    j->foreground = foreground;
+    j->reported = 0;
+    j->started = *started;
+    j->history_seq = history_seq;
+    j->command = strdup(command);
+    j->out_fd = -1;
+    j->err_fd = -1;
+    j->id = id;
+    return id;
+}
+
+int capture_output(void)
+{
+    capture_out = memfd_create("twoshell-out", MFD_CLOEXEC);
+    capture_err = memfd_create("twoshell-err", MFD_CLOEXEC);
+    if (capture_out == -1 || capture_err == -1)
+    {
+        perror(capture_err_msg);
+        if (capture_out != -1)
+        {
+            close(capture_out);
+        }
+        capture_out = -1;
+        return 0;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+    dup2(capture_out, STDOUT_FILENO);
+    dup2(capture_err, STDERR_FILENO);
+    return 1;
+}
+
+void attach_output(int id)
+{
+    if (capture_out == -1)
+    {
+        return;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+    for (int i = 0; i < jobs_max; i++)
+    {
+        if (id > 0 && jobs[i].id == id)
+        {
+            jobs[i].out_fd = capture_out;
+            jobs[i].err_fd = capture_err;
+            capture_out = -1;
+        }
+    }
+    if (capture_out != -1) // no such job, nothing to print
+    {
+        close(capture_out);
+        close(capture_err);
+        capture_out = -1;
+    }
+}
+
+void wait_for_jobs(int max_running)
+{
+    block_sigchld();
+    sigset_t waiting;
+    sigprocmask(SIG_BLOCK, NULL, &waiting);
+    sigdelset(&waiting, SIGCHLD);
+    while (1)
+    {
+        int running = 0;
+        for (int i = 0; i < jobs_max; i++)
+        {
+            running += jobs[i].id != 0 && !job_done(&jobs[i]) && !job_stopped(&jobs[i]);
+        }
+        if (running <= max_running)
+        {
+            break;
+        }
+        // the handler runs (and reaps) inside sigsuspend, so a job finishing between the count and here
+        // can't be missed
+        sigsuspend(&waiting);
+    }
+    unblock_sigchld();
+}
+
+int wait_job(int id, llist *history, run_stats *stats)
+{
+    block_sigchld();
+    job *j = NULL;
+    for (int i = 0; i < jobs_max; i++)
+    {
+        if (id > 0 && jobs[i].id == id)
+        {
+            j = &jobs[i];
+        }
+    }
+    if (j == NULL)
+    {
+        unblock_sigchld();
+        return -1;
+    }
+    return wait_foreground(j, history, stats);
+}
+
+void report_jobs(llist *history, int notify)
+{
+    block_sigchld();
+    // buffered output goes out in the order the lines were read, so one slow line holds back the output
+    // of everything after it (but not the lines themselves)
+    job *j;
+    fflush(stdout);
+    while ((j = first_buffered()) != NULL && job_done(j))
+    {
+        copy_buffer(j->out_fd, STDOUT_FILENO);
+        copy_buffer(j->err_fd, STDERR_FILENO);
+        record_job(j, history);
+        free_job(j);
+    }
+    for (int i = 0; i < jobs_max; i++)
+    {
+        j = &jobs[i];
+        if (j->id == 0 || j->foreground || j->out_fd != -1)
+        {
+            continue;
+        }
+        if (job_done(j))
+        {
+            if (notify)
+            {
+                if (j->stats.status == 0)
+                {
+                    printf("[%d]   Done                    %s\n", j->id, j->command);
+                }
+                else
+                {
+                    printf("[%d]   Exit %-3d                %s\n", j->id, j->stats.status, j->command);
+                }
+            }
+            record_job(j, history);
+            free_job(j);
+        }
+        else if (job_stopped(j))
+        {
+            if (notify && !j->reported)
+            {
+                printf("[%d]+  Stopped                 %s\n", j->id, j->command);
+            }
+            j->reported = 1;
+        }
+        else
+        {
+            j->reported = 0; // running again, tell the user if it stops again
+        }
+    }
+    unblock_sigchld();
+}
+
+void list_jobs(void)
+{
+    block_sigchld();
+    for (int i = 0; i < jobs_max; i++)
+    {
+        job *j = &jobs[i];
+        if (j->id == 0)
+        {
+            continue;
+        }
+        char *state = job_done(j) ? "Done" : job_stopped(j) ? "Stopped" : "Running";
+        printf("[%d]  %-8s  %s\n", j->id, state, j->command);
+    }
+    unblock_sigchld();
+}
+
+int job_processes(jproc *procs, int max)
+{
+    block_sigchld();
+    int count = 0;
+    for (int i = 0; i < jobs_max; i++)
+    {
+        job *j = &jobs[i];
+        for (int k = 0; j->id != 0 && k < j->count; k++)
+        {
+            if (j->pids[k] == -1 || j->states[k] == PROC_DONE)
+            {
+                continue;
+            }
+            if (count < max)
+            {
+                procs[count].id = j->id;
+                procs[count].stage = k;
+                procs[count].stages = j->count;
+                procs[count].pid = j->pids[k];
+            }
+            count++;
+        }
+    }
+    unblock_sigchld();
+    return count;
+}
+
+// wake up every stopped process of the job
+static void continue_job(job *j)
+{
+    for (int k = 0; k < j->count; k++)
+    {
+        if (j->states[k] == PROC_STOPPED)
+        {
+            j->states[k] = PROC_RUNNING;
+        }
+    }
+    j->reported = 0;
+    if (j->pgid > 0)
+    {
+        kill(-(j->pgid), SIGCONT);
+        return;
+    }
+    for (int k = 0; k < j->count; k++)
+    {
+        if (j->states[k] != PROC_DONE)
+        {
+            kill(j->pids[k], SIGCONT);
+        }
+    }
+}
+
+int fg_job(char *spec, llist *history, run_stats *stats)
+{
+    block_sigchld();
+    job *j = find_job(spec, 0);
+    if (j == NULL)
+    {
+        fprintf(stderr, "fg: %s\n", no_job_err_msg);
+        unblock_sigchld();
+        return -1;
+    }
+    printf("%s\n", j->command);
+    fflush(stdout);
+    continue_job(j);
+    return wait_foreground(j, history, stats);
+}
+
+int bg_job(char *spec)
+{
+    block_sigchld();
+    job *j = find_job(spec, 1);
+    if (j == NULL || !job_stopped(j))
+    {
+        fprintf(stderr, "bg: %s\n", no_job_err_msg);
+        unblock_sigchld();
+        return -1;
+    }
+    printf("[%d]+ %s\n", j->id, j->command);
+    continue_job(j);
+    unblock_sigchld();
+    return 0;
+}
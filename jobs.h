@@ -0,0 +1,128 @@
+/*
+    Job table for the shell. Every pipeline the shell starts is a job, and background ones (&) are reaped
+    by a SIGCHLD handler as soon as they exit, so they never pile up as zombies. The handler only ever
+    waits on the exact pids of background jobs, and the shell waits on the exact pids of the foreground
+    job, so neither can reap the other's children.
+    With job control on (interactive shells), each job gets its own process group and the foreground job
+    gets the terminal, which is what makes CTRL-Z, fg and bg work.
+    The table is only changed with SIGCHLD blocked, so the handler always sees it in one piece.
+*/
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <signal.h>
+#include <sys/types.h>
+#include <time.h>
+#include "linked_list.h"
+#include "parse.h"
+
+#define PROC_RUNNING 0
+#define PROC_STOPPED 1
+#define PROC_DONE 2
+
+typedef struct job_process
+{
+    int id;     // job it belongs to
+    int stage;  // where it is in the pipeline, from 0
+    int stages; // how long the pipeline is
+    pid_t pid;
+} jproc;
+
+typedef struct job
+{
+    int id;                   // job number the user sees ([1], [2], ...), 0 marks a free slot
+    pid_t pgid;               // process group of the whole pipeline, 0 if job control is off
+    pid_t *pids;              // every process in the pipeline (-1 for any that never started)
+    int *states;              // PROC_ state of each process, kept up to date by the SIGCHLD handler
+    int count;                // number of processes
+    int foreground;           // the shell is waiting on this job itself, the SIGCHLD handler keeps out
+    int reported;             // user has been told the job stopped (so don't keep telling them)
+    run_stats stats;          // CPU time/memory of the processes reaped so far, status of the last one
+    struct timespec started;  // when the job was started, for its wall clock time
+    int history_seq;          // history entry (see entry_seq) the job was run from, -1 if none
+    char *command;            // command line, for jobs/fg/bg and notifications
+    int out_fd;               // buffer holding the job's stdout until it's its turn to print (-1 if unbuffered)
+    int err_fd;               // same for stderr
+} job;
+
+/*
+    Set up the job table and install the SIGCHLD handler. job_control turns on process groups and
+    handing the terminal to the foreground job, which only makes sense for an interactive shell.
+*/
+void init_jobs(int job_control);
+
+/*
+    Returns 1 if job control is on.
+*/
+int job_control_on(void);
+
+/*
+    Block/unblock SIGCHLD. The shell blocks it from starting a pipeline until add_job has put it in the
+    table, so the handler can't miss (or reap) a process it doesn't know about yet.
+*/
+void block_sigchld(void);
+void unblock_sigchld(void);
+
+/*
+    Puts the (already started) pipeline in the job table and returns its job id. started is the
+    CLOCK_MONOTONIC time from before the pipeline was started. SIGCHLD must be blocked.
+*/
+int add_job(struct command commands[], int command_count, char *command, int foreground, int history_seq,
+            struct timespec *started);
+
+/*
+    Sends the shell's stdout and stderr (and so those of anything it starts) to a fresh pair of in-memory
+    buffers, until attach_output hands them to the job that was started in the meantime. Used by parallel
+    batch mode, where lines run at the same time but their output has to come out in order. Returns 0 if
+    the buffers couldn't be made, in which case output isn't redirected.
+*/
+int capture_output(void);
+
+/*
+    Puts stdout and stderr back, and gives the buffers capture_output made to the given job. report_jobs
+    prints them once the job is done and every buffered job before it (by history entry) has printed.
+*/
+void attach_output(int id);
+
+/*
+    Waits until no more than max_running jobs are still running (stopped ones don't count), reaping
+    as they finish. wait_for_jobs(0) is the "wait" builtin.
+*/
+void wait_for_jobs(int max_running);
+
+/*
+    Waits, in the foreground, for the given job: gives it the terminal, waits on each of its pids, and
+    takes the terminal back. Returns 1 if the job finished, recording its run_stats in history (and
+    stats, if not NULL), 0 if it was stopped (CTRL-Z), in which case it stays in the table as a stopped
+    background job. -1 if there is no such job.
+*/
+int wait_job(int id, llist *history, run_stats *stats);
+
+/*
+    Tell the user about background jobs that finished or stopped since last time (if notify is set),
+    record the finished ones' run_stats in history, and drop them from the table. Finished jobs with
+    buffered output print it here, in the order they were started.
+*/
+void report_jobs(llist *history, int notify);
+
+/*
+    Built in command: jobs. Lists every job with its state.
+*/
+void list_jobs(void);
+
+/*
+    Fills procs with every process of a background job that hasn't exited yet (stopped ones included),
+    up to max of them. Returns how many there are, which may be more than max.
+*/
+int job_processes(jproc *procs, int max);
+
+/*
+    Built in commands: fg and bg. spec is "%n", "n" or NULL for the most recent job. fg continues the job
+    in the foreground and waits for it, returning what wait_job would. bg continues a stopped job in the
+    background. Both return -1 if there is no such job.
+*/
+int fg_job(char *spec, llist *history, run_stats *stats);
+int bg_job(char *spec);
+
+#endif
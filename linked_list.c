@@ -4,208 +4,374 @@
 #include <string.h>
 
 #include "linked_list.h"
+#include "frecency.h"
 
-void empty_list(llist* list) {
-    if (list -> length <= 0) {
+// ring index of the given list index. capacity is a power of two, so masking wraps for us
+#define slot(list, index) (((list) -> start + (index)) & ((list) -> capacity - 1))
+
+// entries from add_last_ref belong to someone else, every other entry lives in the slab
+#define in_slab(list, v) ((v) >= (list) -> slab && (v) < (list) -> slab + (list) -> slab_used)
+
+// smallest slab worth having
+#define MIN_SLAB 4096
+
+// double the ring, unrolling it so entry 0 lands back at vals[0]
+static void grow(llist* list) {
+    int new_capacity = list -> capacity == 0 ? 16 : list -> capacity * 2;
+    char** new_vals = malloc(sizeof(char*) * new_capacity);
+    run_stats* new_stats = malloc(sizeof(run_stats) * new_capacity);
+    for (int i = 0; i < list -> length; i++) {
+        new_vals[i] = list -> vals[slot(list, i)];
+        new_stats[i] = list -> stats[slot(list, i)];
+    }
+    free(list -> vals);
+    free(list -> stats);
+    list -> vals = new_vals;
+    list -> stats = new_stats;
+    list -> start = 0;
+    list -> capacity = new_capacity;
+}
+
+// move every entry in the slab into a new slab with room for at least need more bytes, leaving out
+// the space of removed entries. The new slab is at least twice what's live, so the copying this does
+// is paid for by the bytes added (or removed) before it has to happen again.
+static void compact_slab(llist* list, int need) {
+    int live = list -> slab_used - list -> slab_dead;
+    int new_size = MIN_SLAB;
+    while (new_size < 2 * (live + need)) {
+        new_size *= 2;
+    }
+    char* new_slab = malloc(new_size);
+    int used = 0;
+    for (int i = 0; i < list -> length; i++) {
+        char* v = list -> vals[slot(list, i)];
+        if (in_slab(list, v)) {
+            int length = strlen(v) + 1;
+            memcpy(new_slab + used, v, length);
+            list -> vals[slot(list, i)] = new_slab + used;
+            used += length;
+        }
+    }
+    free(list -> slab);
+    list -> slab = new_slab;
+    list -> slab_used = used;
+    list -> slab_size = new_size;
+    list -> slab_dead = 0;
+}
+
+// copy v onto the end of the slab
+static char* slab_copy(llist* list, char* v) {
+    int length = strlen(v) + 1;
+    if (list -> slab_used + length > list -> slab_size) {
+        compact_slab(list, length);
+    }
+    char* copy = list -> slab + list -> slab_used;
+    memcpy(copy, v, length);
+    list -> slab_used += length;
+    return copy;
+}
+
+// the entry is leaving the list, its bytes in the slab are dead until the next compaction
+static void release(llist* list, char* v) {
+    if (in_slab(list, v)) {
+        list -> slab_dead += strlen(v) + 1;
+    }
+}
+
+// throw the prefix index away, index_entries builds it back up from scratch
+static void drop_index(llist* list) {
+    free_trie(&(list -> prefixes));
+    init_trie(&(list -> prefixes));
+    list -> unindexed = list -> length;
+    list -> evicted = 0;
+}
+
+void init_list(llist* list) {
+    list -> vals = NULL;
+    list -> stats = NULL;
+    list -> start = 0;
+    list -> length = 0;
+    list -> capacity = 0;
+    init_trie(&(list -> prefixes));
+    list -> first_seq = 0;
+    list -> unindexed = 0;
+    list -> slab = NULL;
+    list -> slab_used = 0;
+    list -> slab_size = 0;
+    list -> slab_dead = 0;
+    list -> limit = 0;
+    list -> dedup = 0;
+    list -> evicted = 0;
+    list -> commands = NULL;
+    list -> untracked = 0;
+}
+
+// make room for one more entry under the limit by dropping the oldest one
+static void evict(llist* list) {
+    if (list -> limit <= 0 || list -> length < list -> limit) {
         return;
     }
-    node* current = list -> head;
-    while (1) {
-        if (current -> next == NULL) { // we've reached the end
-            break;
+    int indexed = list -> unindexed == 0;
+    remove_index(list, 0);
+    // the prefix index still has the evicted entry in it (contains() just skips them). Once it's
+    // holding a whole limit's worth of them, throw it away, it gets built back up from what's left.
+    // That keeps it from growing forever too.
+    if (indexed && ++(list -> evicted) >= list -> limit) {
+        drop_index(list);
+    }
+}
+
+void set_limit(llist* list, int limit) {
+    list -> limit = limit;
+    while (limit > 0 && list -> length > limit) {
+        remove_index(list, 0);
+    }
+}
+
+void set_dedup(llist* list, int dedup) {
+    list -> dedup = dedup;
+}
+
+void track_commands(llist* list, struct command_stats* commands) {
+    list -> commands = commands;
+    list -> untracked = list -> length;
+}
+
+int track_entries(llist* list, int max) {
+    for (; max > 0 && list -> untracked > 0; max--) {
+        list -> untracked--;
+        command_loaded(list -> commands, list -> vals[slot(list, list -> untracked)],
+                       list -> first_seq + list -> untracked);
+    }
+    return list -> untracked > 0;
+}
+
+void empty_list(llist* list) {
+    if (list -> commands != NULL) {
+        for (int i = list -> untracked; i < list -> length; i++) {
+            command_removed(list -> commands, list -> vals[slot(list, i)]);
         }
-        node* next = current -> next; // where we're going
-        free(current->val); // free current
-        current -> next = NULL;
-        current -> previous = NULL;
-        free(current);
-        current = next;
-    } // so free the last node
-        free(current->val);
-        current -> next = NULL;
-        current -> previous = NULL;
-        free(current);
-        list -> head = NULL;
-        list -> tail = NULL;
-        list -> length = 0;
+    }
+    list -> untracked = 0;
+    // keep the ring and the slab around, the list is going to be refilled
+    list -> start = 0;
+    list -> length = 0;
+    list -> slab_used = 0;
+    list -> slab_dead = 0;
+    drop_index(list);
 }
 
 void print(llist* list, char spacer)
 {
-    int i = 0;    
-    if (list->head != NULL)
+    for (int i = 0; i < list -> length; i++)
+    {
+        printf("%d  %s%c", i, list -> vals[slot(list, i)], spacer);
+    }
+}
+
+void print_stats(llist* list)
+{
+    for (int i = 0; i < list -> length; i++)
     {
-        node *current = list->head;
-        while (1)
+        run_stats* s = &(list -> stats[slot(list, i)]);
+        if (!s -> recorded)
         {
-            printf("%d  %s%c", i++, current->val, spacer);
-            if (current->next == NULL)
-            {
-                break;
-            }
-            current = current->next;
+            printf("%d  %s\n", i, list -> vals[slot(list, i)]);
+            continue;
         }
+        printf("%d  %s    [exit %d, %.3fs real, %.3fs user, %.3fs sys, %ldKB max rss]\n", i,
+               list -> vals[slot(list, i)], s -> status, s -> wall_ns / 1e9, s -> user_us / 1e6,
+               s -> sys_us / 1e6, s -> max_rss_kb);
     }
 }
 
 void print_rev(llist* list, char spacer)
 {
-    int i = (list -> length)--;
-    if (list->tail != NULL)
+    for (int i = (list -> length) - 1; i >= 0; i--)
     {
-        node *current = list->tail;
-        while (1)
-        {
-            printf("%d  %s%c", i--, current->val, spacer);
-            if (current->previous == NULL)
-            {
-                break;
-            }
-            current = current->previous;
-        }
+        printf("%d  %s%c", i, list -> vals[slot(list, i)], spacer);
     }
 }
 
 void add_first(llist *list, char *v)
 {
-        node *n = malloc(sizeof(node));
-
-        char c;
-        // count size of new node's value
-        int i = 0;
-        do {
-            c = v[i++];
-
-        } while(c != '\0');
-        // new node is set up
-        char* copy = malloc(sizeof(char) * i);
-        strcpy(copy, v);
-        n->val = copy;
-
-    if (list->length == 0) // now to add it to the list
+    if (list -> limit > 0 && list -> length >= list -> limit)
     {
-        list->head = n;
-        list->tail = n;
+        return; // it would be the oldest entry, so the first to go
     }
-    else
+    if (list -> length == list -> capacity)
     {
-        node *old = list->head;
-        list->head = n;
-        list->head->next = old;
-        old->previous = list->head;
+        grow(list);
     }
+    char* copy = slab_copy(list, v);
+    if (list -> untracked > 0) {
+        list -> untracked++; // it's in front of the ones commands hasn't been told about, so it joins them
+    } else if (list -> commands != NULL) {
+        command_added(list -> commands, copy);
+    }
+    // step start back one slot (wrapping), the new value becomes entry 0
+    list -> start = (list -> start - 1) & (list -> capacity - 1);
+    list -> vals[list -> start] = copy;
+    list -> stats[list -> start].recorded = 0;
     (list->length)++;
-
+    // every entry after it moved up one, so the sequence numbers in the index are all off by one
+    drop_index(list);
 }
 
-void add_last(llist *list, char *v)
+int add_last(llist *list, char *v)
 {
-        node *n = malloc(sizeof(node));
-        char c;
-        int i = 0;
-        // count size of new node's value
-        do {
-            c = v[i++];
-
-        } while(c != '\0');
-        // set up new node
-        char* copy = malloc(sizeof(char) * i);
-        strcpy(copy, v);
-        n->val = copy;
-    if (list->length == 0) // add it to list
+    if (list -> dedup && list -> length > 0 && !strcmp(v, list -> vals[slot(list, list -> length - 1)]))
     {
-        list->head = n;
-        list->tail = n;
+        if (list -> commands != NULL) {
+            if (list -> untracked == list -> length) {
+                track_entries(list, 1); // the last entry, it has to be in the table to have run again
+            }
+            command_ran(list -> commands, v, list -> first_seq + list -> length - 1); // still ran
+        }
+        free(v);
+        return 0;
     }
-    else
+    evict(list);
+    if (list -> length == list -> capacity)
     {
-        node *old = list->tail;
-        list->tail = n;
-        list->tail->previous = old;
-        old->next = list->tail;
+        grow(list);
     }
-    (list -> length)++;
-    // needing to free v here and not in add_first is because I realized last minute I had a memory leak here,
-    // and this function actually only gets used ONCE, so rather than restructure the night before the 
-    // assignment is do, I'm doing this.
+    char* copy = slab_copy(list, v);
     free(v);
+    list -> vals[slot(list, list -> length)] = copy;
+    list -> stats[slot(list, list -> length)].recorded = 0;
+    // the newest entry, so the indexed entries are still everything after the unindexed ones
+    trie_insert(&(list -> prefixes), copy, list -> first_seq + list -> length);
+    if (list -> commands != NULL) {
+        command_added(list -> commands, copy);
+        command_ran(list -> commands, copy, list -> first_seq + list -> length);
+    }
+    (list -> length)++;
+    return 1;
+}
+
+void add_last_ref(llist *list, char *v)
+{
+    evict(list);
+    if (list -> length == list -> capacity)
+    {
+        grow(list);
+    }
+    list -> vals[slot(list, list -> length)] = v;
+    list -> stats[slot(list, list -> length)].recorded = 0;
+    if (list -> commands != NULL) {
+        command_added(list -> commands, v);
+        command_ran(list -> commands, v, list -> first_seq + list -> length);
+    }
+    if (list -> unindexed == list -> length) {
+        list -> unindexed++; // nothing's indexed yet, leave it for index_entries with the rest
+    } else {
+        trie_insert(&(list -> prefixes), v, list -> first_seq + list -> length);
+    }
+    (list -> length)++;
+}
+
+int index_entries(llist* list, int max) {
+    for (; max > 0 && list -> unindexed > 0; max--) {
+        list -> unindexed--;
+        trie_insert(&(list -> prefixes), list -> vals[slot(list, list -> unindexed)],
+                    list -> first_seq + list -> unindexed);
+    }
+    return list -> unindexed > 0;
 }
 
 int contains(llist* list, char* value) {
-    // if a value is going to match for the first 'n' characters, it'll match for the first
-    // char. Since we mark it as a 'hit' as soon as the user types a char that matches one from history,
-    // we really only need to compare the first character of value with each node's value
-    node* n = list -> head; 
-    int i = 0;
-    while (n != NULL) {
-        if (n -> val[0] == value[0]) {
+    // the trie hands back the newest indexed entry with this prefix, and every indexed entry is newer than
+    // every unindexed one. If that entry has since been removed from the front of the list, every other
+    // entry with the prefix is older still, so they're gone too.
+    int seq = trie_latest(&(list -> prefixes), value);
+    if (seq >= list -> first_seq) {
+        return seq - list -> first_seq;
+    }
+    // not indexed (yet), check the rest one at a time, newest first
+    int length = strlen(value);
+    for (int i = list -> unindexed - 1; i >= 0; i--) {
+        if (!strncmp(list -> vals[slot(list, i)], value, length)) {
             return i;
         }
-        i++;
-        n = n -> next;
     }
     return -1;
 }
 
 void remove_index(llist *list, int index)
 {
-    if (index >= list->length)
+    if (index < 0 || index >= list->length)
     {
         return;
     }
-    else
+    if (index < list -> untracked) {
+        list -> untracked--; // commands never knew about it
+    } else if (list -> commands != NULL) {
+        command_removed(list -> commands, list -> vals[slot(list, index)]);
+    }
+    release(list, list -> vals[slot(list, index)]);
+    if (index < list -> unindexed) {
+        list -> unindexed--;
+    }
+    // close the hole by shifting whichever side of it is shorter
+    if (index < list -> length / 2)
     {
-        if (index == 0) // node 2 becomes head
-        { // remove head
-            node *old = list->head;
-            list->head = old->next;
-            list->head->previous = NULL;
-            old->next = NULL;
-            free(old);
-        }
-        else if ((index + 1) == list->length) // second to last node becomes tail
-        { // remove tail
-            node *old = list->tail;
-            list->tail = old->previous;
-            list->tail->next = NULL;
-            old->previous = NULL;
-            free(old);
+        for (int i = index; i > 0; i--)
+        {
+            list -> vals[slot(list, i)] = list -> vals[slot(list, i - 1)];
+            list -> stats[slot(list, i)] = list -> stats[slot(list, i - 1)];
         }
-        else // increment through the list to find the appropriate node
+        list -> start = (list -> start + 1) & (list -> capacity - 1);
+    }
+    else
+    {
+        for (int i = index; i < list -> length - 1; i++)
         {
-            int i = 0;
-            node *current = list->head;
-            while (i != index)
-            {
-                current = current->next;
-                i++;
-            }
-            // don't forget to free char*
-            node *previous = current->previous;
-            previous->next = current->next;
-            node *next = current->next;
-            next->previous = current->previous;
-            current->previous = NULL;
-            current->next = NULL;
-            free(current);
+            list -> vals[slot(list, i)] = list -> vals[slot(list, i + 1)];
+            list -> stats[slot(list, i)] = list -> stats[slot(list, i + 1)];
         }
-        list -> length--; // <- DON'T FORGET THIS
+    }
+    list -> length--; // <- DON'T FORGET THIS
+    if (index == 0) {
+        list -> first_seq++; // everything after it keeps its sequence number
+    } else {
+        drop_index(list);
     }
 }
 
 char* get(llist* list, int index) {
-    
+
     if (index < 0 || index >= (list -> length)) {
         return NULL;
     }
+    return list -> vals[slot(list, index)];
+}
 
-    int i = 0;
-    node* n = list -> head;
-    while (i < index) { // increment through, find the right index
-        n = n -> next;
-        i++;
+void set_stats(llist* list, int index, run_stats* stats) {
+    if (index < 0 || index >= (list -> length)) {
+        return;
+    }
+    list -> stats[slot(list, index)] = *stats;
+    list -> stats[slot(list, index)].recorded = 1;
+    if (list -> commands != NULL) {
+        command_finished(list -> commands, list -> vals[slot(list, index)], stats);
     }
-    return n -> val;
 }
 
+run_stats* get_stats(llist* list, int index) {
+    if (index < 0 || index >= (list -> length)) {
+        return NULL;
+    }
+    return &(list -> stats[slot(list, index)]);
+}
+
+int entry_seq(llist* list, int index) {
+    return list -> first_seq + index;
+}
 
+int seq_index(llist* list, int seq) {
+    if (seq < list -> first_seq || seq - list -> first_seq >= list -> length) {
+        return -1;
+    }
+    return seq - list -> first_seq;
+}
@@ -1,32 +1,79 @@
 /*
-    Implementation of a doubly linked_list (of char*'s) for use in the shell. 
-    Tracks the history of commands run (or attempted to be run) on the shell. 
+    History store (of char*'s) for use in the shell.
+    Tracks the history of commands run (or attempted to be run) on the shell.
+    This started life as a doubly linked_list (hence the name), but get() had to walk from the head
+    on every call and the prompt calls it once per history entry, so the entries now live in a ring
+    buffer that doubles in size when it fills up. get() is O(1), add_first/add_last are O(1) amortized,
+    and the rest of the llist API is unchanged.
+    The entries themselves are packed one after another into a single slab rather than malloc'd one by one.
+    Removed entries leave holes that get squeezed out when the slab next fills up.
+    The list can be capped (set_limit), in which case the oldest entry is dropped to make room for each new
+    one, and the ring, the slab and the prefix index all stop growing.
+    add_last also keeps a prefix index (trie.h) up to date, which is what contains() answers from.
+    Entries loaded with add_last_ref aren't indexed as they're added (a million of them takes the best
+    part of two seconds), they're left for index_entries() to do a chunk at a time, newest first, while
+    the prompt waits for keys. Until it's done, a prefix the indexed entries don't have is looked for
+    in the rest one entry at a time.
     Includes several unused functions because I was procrastinating actually doing the assignment.
 */
 
 #ifndef LINKED_LIST_H
 #define LINKED_LIST_H
 
-typedef struct node
+#include "trie.h"
+
+/*
+    What running a history entry cost. Only filled in for commands the shell waited on itself.
+*/
+typedef struct run_stats
 {
-    char *val;
-    struct node *next;
-    struct node *previous;
-} node;
+    int recorded;      // 0 until the command has finished and been waited on
+    int status;        // exit status of the (last) command, 128 + signal number if it was killed
+    long long wall_ns; // wall clock time from starting the command to the last process exiting
+    long long user_us; // user CPU time, summed over every process in the pipeline
+    long long sys_us;  // system CPU time, summed the same way
+    long max_rss_kb;   // largest max resident set size of any process in the pipeline
+} run_stats;
+
+struct command_stats; // frecency.h
 
 typedef struct linked_list
 {
-    node *head;
-    node *tail;
-    int length;
+    char **vals;  // ring of entries, entry 0 lives at vals[start]
+    run_stats *stats; // ring of what running each entry cost, same slots as vals
+    int start;    // ring index of the first (oldest) entry
+    int length;   // number of entries in use
+    int capacity; // number of slots in vals, always 0 or a power of two
+    trie prefixes; // prefix index, entries are stored by sequence number
+    int first_seq; // sequence number of entry 0
+    int unindexed; // entries at the front not in the prefix index yet, everything after them is
+    char *slab;    // every entry not added with add_last_ref, one after another
+    int slab_used; // bytes of slab in use, including removed entries
+    int slab_size; // bytes of slab
+    int slab_dead; // bytes of slab belonging to removed entries, reclaimed when the slab is compacted
+    int limit;     // most entries the list will hold, 0 for no limit
+    int dedup;     // add_last skips a value that's the same as the last entry
+    int evicted;   // indexed entries dropped for the limit since the prefix index was last thrown away
+    struct command_stats *commands; // told about every command added and every run_stats recorded, NULL for none
+    int untracked; // entries at the front commands hasn't been told about yet (see track_entries)
 } llist;
 
+/*
+    Set up an empty list. Must be called before any other function is used on the list.
+*/
+void init_list(llist *list);
+
 /*
     Print linked list, using the given char as a "spacer" between elements
 
 */
 void print(llist* list, char);
 
+/*
+    Print linked list with the recorded run_stats (exit status, times, memory) next to each entry
+*/
+void print_stats(llist* list);
+
 /*
     Print linked list in reverse, using the given char as a "spacer" between elements
 */
@@ -39,8 +86,44 @@ void add_first(llist *list, char *v);
 
 /*
     Adds the given char* to the end of the linked list, AND RELEASES THE MEMORY -- use with caution
+    Returns 1 if it was added, 0 if it was dropped as a duplicate of the last entry (see set_dedup).
 */
-void add_last(llist *list, char *v);
+int add_last(llist *list, char *v);
+
+/*
+    Adds the given char* to the end of the list WITHOUT copying it or taking ownership of it, for entries
+    that outlive the list anyway (lines of a memory mapped history file). Unless the list has already been
+    indexed, indexing these entries for contains() is left to index_entries, so loading a huge history
+    stays cheap.
+*/
+void add_last_ref(llist *list, char *v);
+
+/*
+    Cap the list at limit entries (0 for no cap). Adding past the cap drops the oldest entry, and if
+    the list is already over it the oldest entries are dropped now.
+*/
+void set_limit(llist *list, int limit);
+
+/*
+    If dedup is set, add_last ignores a value that's the same as the last entry (like bash's ignoredups).
+*/
+void set_dedup(llist *list, int dedup);
+
+/*
+    From now on, tell commands about every entry added to the end of the list (it was run), every
+    set_stats (it finished) and every entry added or removed anywhere, so its table only ever holds
+    commands still in the list. See frecency.h.
+    Entries already in the list aren't told about straight away (a million of them takes about a second),
+    that's left to track_entries.
+*/
+void track_commands(llist *list, struct command_stats *commands);
+
+/*
+    Tell commands about up to max of the entries that were already in the list when track_commands was
+    called, newest first, as runs from before (see command_loaded). Returns 1 if there are still some
+    left, 0 once it knows about them all. An entry removed before it's told about is never told about.
+*/
+int track_entries(llist *list, int max);
 
 /*
     Removes the given index from the list, if the index is within bounds of the list.
@@ -57,10 +140,40 @@ void empty_list(llist *list);
 char* get(llist* list, int index);
 
 /*
-    Returns 1 if any element of the list begins with the char* passed to value
+    Record what running the entry at the given index cost, if the index is within the bounds of the list.
+*/
+void set_stats(llist* list, int index, run_stats* stats);
+
+/*
+    Return the run_stats of the entry at the given index (recorded is 0 if nothing has been recorded),
+    NULL if the index is out of bounds.
+*/
+run_stats* get_stats(llist* list, int index);
+
+/*
+    Returns a number that keeps identifying the entry at the given index while older entries are removed
+    from the front of the list (which shifts every index). Use seq_index to turn it back into an index.
+*/
+int entry_seq(llist* list, int index);
+
+/*
+    Returns the current index of the entry entry_seq gave seq for, -1 if that entry is gone.
+*/
+int seq_index(llist* list, int seq);
+
+/*
+    Add up to max of the entries not in the prefix index yet to it, newest first. Returns 1 if there are
+    still some left, 0 once everything is indexed.
+*/
+int index_entries(llist* list, int max);
+
+/*
+    Returns the index of the most recent element of the list that begins with the char* passed to value,
+    -1 if there is none. O(length of value) once index_entries has caught up. Before that, a prefix
+    only the unindexed entries have costs a strncmp per unindexed entry (about 10ms for a million of
+    them, see "make bench"), still far short of indexing them all.
 */
 int contains(llist* list, char* value);
 
 
 #endif
-
@@ -0,0 +1,125 @@
+#include <string.h>
+#include "parse.h"
+
+#define is_space(c) ((c) == ' ' || (c) == '\t' || (c) == '\n')
+
+int tokenize(arena *a, char *line, char ***tokens)
+{
+    int length = strlen(line);
+    // at worst every other char starts a token ("a b c"), plus the NULL on the end
+    char **arr = arena_alloc(a, sizeof(char *) * (length / 2 + 2));
+    char *out = arena_alloc(a, length + 1);
+    int count = 0;
+
+    int i = 0;
+    while (1)
+    {
+        while (is_space(line[i])) // skip to the start of the next token
+        {
+            i++;
+        }
+        if (line[i] == '\0')
+        {
+            break;
+        }
+        arr[count++] = out;
+        while (line[i] != '\0' && !is_space(line[i]))
+        {
+            *out++ = line[i++];
+        }
+        *out++ = '\0';
+    }
+    arr[count] = NULL;
+
+    *tokens = arr;
+    return count;
+}
+
+struct command load(char **arr, int size)
+{
+    int exel = size; // to track command+flag length
+    int inl = 0;     // index of in file
+    int outl = 0;    // index of out file
+
+    struct command temp;
+    temp.in = NULL;
+    temp.out = NULL;
+    temp.pid = -1;
+    temp.redir_in = 0;
+    temp.redir_out = 0;
+    temp.append = 0;
+
+    for (int i = 0; i < size; i++)
+    {
+        if (!strcmp(arr[i], "<"))
+        {
+            exel = i;
+            inl = i + 1;
+            temp.redir_in = 1;
+        }
+        else if (!strcmp(arr[i], ">"))
+        {
+            outl = i + 1;
+            temp.redir_out = 1;
+
+            if (exel == size)
+            { // if no redirection symbol found yet
+                exel = i;
+            }
+        }
+        else if (!strcmp(arr[i], ">>"))
+        {
+            outl = i + 1;
+            temp.redir_out = 1;
+            temp.append = 1;
+            if (exel == size)
+            { // if no redirection symbol found yet
+                exel = i;
+            }
+        }
+    }
+
+    // file names have to be picked up before the NULL goes in, it may land on a redirect symbol
+    if (inl != 0)
+    {
+        temp.in = inl < size ? arr[inl] : NULL;
+    }
+    if (outl != 0)
+    {
+        temp.out = outl < size ? arr[outl] : NULL;
+    }
+
+    temp.exe_size = exel;
+    temp.exe = arr;
+    temp.exe[temp.exe_size] = NULL;
+
+    return temp;
+}
+
+int load_pipeline(arena *a, char **tokens, int count, struct command **commands)
+{
+    int command_count = 1; // always one more command than pipe
+    for (int i = 0; i < count; i++)
+    {
+        if (!strcmp(tokens[i], "|"))
+        {
+            command_count++;
+        }
+    }
+
+    struct command *loaded = arena_alloc(a, sizeof(struct command) * command_count);
+    int j = 0;
+    int curr = 0;
+    for (int i = 0; i <= count; i++)
+    {
+        // kind of like a sliding window, the NULL at tokens[count] closes the last command
+        if (i == count || !strcmp(tokens[i], "|"))
+        {
+            loaded[curr++] = load(tokens + j, i - j);
+            j = i + 1; // always skipping the pipe char itself
+        }
+    }
+
+    *commands = loaded;
+    return command_count;
+}
@@ -0,0 +1,46 @@
+/*
+    Turning a command line into command structs, without copying it more than once.
+    tokenize() makes a single pass over the line, writing each token (null terminated) into an arena, and
+    everything built from the tokens afterwards -- each command's exe, in and out -- just points into
+    that same arena. Once the line has been run, one arena_reset() frees all of it.
+*/
+
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <sys/types.h> // pid_t
+#include "arena.h"
+
+struct command
+{
+    char **exe;    // command and flags
+    char *in;      // input file name
+    char *out;     // output file name
+    pid_t pid;     // pid of process executing command
+    int exe_size;  // 1 + number of flags
+    int redir_in;  // flag to indicate <
+    int redir_out; // flag to indicate >
+    int append;    // flag to indicate >>
+};
+
+/*
+    Splits line at whitespace into tokens, stored in the arena. *tokens is set to a NULL terminated array
+    of them (also in the arena). line itself isn't touched. Returns the number of tokens.
+*/
+int tokenize(arena *a, char *line, char ***tokens);
+
+/*
+    Returns a struct "loaded" with the given command, flags, and redirect options. Given one full
+    "command". For example, if the user enters "ls -l | grep a", the load function expects a pointer
+    to JUST ls -l. Nothing is copied: exe is arr itself, cut off with a NULL where the command's flags
+    end (so arr[size] may be overwritten), and in/out point at the tokens after < and >.
+*/
+struct command load(char **arr, int size);
+
+/*
+    Splits the tokens into one command per pipe ('|') and loads each of them. *commands is set to an
+    array of them, allocated in the arena. Returns the number of commands (number of pipes + 1).
+*/
+int load_pipeline(arena *a, char **tokens, int count, struct command **commands);
+
+#endif
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "path_hash.h"
+
+// FNV-1a
+static unsigned int hash_name(char *name)
+{
+    unsigned int h = 2166136261u;
+    for (; *name != '\0'; name++)
+    {
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    }
+    return h;
+}
+
+// slot holding name, or the empty slot it would go in
+static int probe(phash *h, char *name)
+{
+    int i = hash_name(name) & (h->max - 1);
+    while (h->slots[i].name != NULL && strcmp(h->slots[i].name, name))
+    {
+        i = (i + 1) & (h->max - 1);
+    }
+    return i;
+}
+
+// double the table, keeping it at most half full so probes stay short
+static void grow(phash *h)
+{
+    path_entry *old = h->slots;
+    int old_max = h->max;
+    h->max = old_max == 0 ? 64 : old_max * 2;
+    h->slots = calloc(h->max, sizeof(path_entry));
+    for (int i = 0; i < old_max; i++)
+    {
+        if (old[i].name != NULL)
+        {
+            h->slots[probe(h, old[i].name)] = old[i];
+        }
+    }
+    free(old);
+}
+
+// look for name in each directory of $PATH, returns a malloc'd full path or NULL. *relative is set if
+// a relative directory was checked on the way, so the answer depends on the current directory
+static char *search_path(char *name, int *relative)
+{
+    *relative = 0;
+    char *path_var = getenv("PATH");
+    if (path_var == NULL)
+    {
+        path_var = "/usr/local/bin:/usr/bin:/bin"; // same default execvp uses
+    }
+    int name_length = strlen(name);
+    char *dir = path_var;
+    while (1)
+    {
+        char *end = strchr(dir, ':');
+        int dir_length = end == NULL ? (int)strlen(dir) : end - dir;
+        char *full = malloc(dir_length + name_length + 3);
+        *relative |= dir[0] != '/';
+        if (dir_length == 0) // an empty entry means the current directory
+        {
+            full[0] = '.';
+            dir_length = 1;
+        }
+        else
+        {
+            memcpy(full, dir, dir_length);
+        }
+        full[dir_length] = '/';
+        memcpy(full + dir_length + 1, name, name_length + 1);
+
+        struct stat st;
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0)
+        {
+            return full;
+        }
+        free(full);
+        if (end == NULL)
+        {
+            return NULL;
+        }
+        dir = end + 1;
+    }
+}
+
+void init_path_hash(phash *h)
+{
+    h->slots = NULL;
+    h->count = 0;
+    h->max = 0;
+    h->path_var = NULL;
+    h->uncached = NULL;
+}
+
+char *find_command(phash *h, char *name)
+{
+    if (strchr(name, '/') != NULL)
+    {
+        return name;
+    }
+
+    char *path_var = getenv("PATH");
+    if ((path_var == NULL) != (h->path_var == NULL) || (path_var != NULL && strcmp(path_var, h->path_var)))
+    {
+        // $PATH changed, everything in the table could be wrong now
+        clear_path_hash(h);
+        h->path_var = path_var == NULL ? NULL : strdup(path_var);
+    }
+
+    if (h->max > 0)
+    {
+        path_entry *e = &(h->slots[probe(h, name)]);
+        if (e->name != NULL)
+        {
+            e->hits++;
+            return e->path;
+        }
+    }
+
+    int relative;
+    char *full = search_path(name, &relative);
+    if (full == NULL)
+    {
+        return NULL; // not remembered, it may well be installed before the next try
+    }
+    if (relative)
+    {
+        free(h->uncached);
+        h->uncached = full;
+        return full;
+    }
+    if (2 * (h->count + 1) > h->max)
+    {
+        grow(h);
+    }
+    path_entry *e = &(h->slots[probe(h, name)]);
+    e->name = strdup(name);
+    e->path = full;
+    e->hits = 1;
+    h->count++;
+    return full;
+}
+
+void forget_command(phash *h, char *name)
+{
+    if (h->max == 0)
+    {
+        return;
+    }
+    int i = probe(h, name);
+    if (h->slots[i].name == NULL)
+    {
+        return;
+    }
+    free(h->slots[i].name);
+    free(h->slots[i].path);
+    h->slots[i].name = NULL;
+    h->count--;
+    // put back everything after the hole up to the next empty slot, some of it may have probed past it
+    for (int j = (i + 1) & (h->max - 1); h->slots[j].name != NULL; j = (j + 1) & (h->max - 1))
+    {
+        path_entry moved = h->slots[j];
+        h->slots[j].name = NULL;
+        h->slots[probe(h, moved.name)] = moved;
+    }
+}
+
+void clear_path_hash(phash *h)
+{
+    for (int i = 0; i < h->max; i++)
+    {
+        if (h->slots[i].name != NULL)
+        {
+            free(h->slots[i].name);
+            free(h->slots[i].path);
+        }
+    }
+    free(h->slots);
+    free(h->path_var);
+    free(h->uncached);
+    init_path_hash(h);
+}
+
+void print_path_hash(phash *h)
+{
+    if (h->count == 0)
+    {
+        printf("hash: hash table empty\n");
+        return;
+    }
+    printf("hits\tcommand\n");
+    for (int i = 0; i < h->max; i++)
+    {
+        if (h->slots[i].name != NULL)
+        {
+            printf("%4d\t%s\n", h->slots[i].hits, h->slots[i].path);
+        }
+    }
+}
@@ -0,0 +1,49 @@
+/*
+    Hash table of where each command lives on $PATH, like bash's hash.
+    The first time a command is run, each directory on $PATH is checked for it (one stat() each, rather
+    than one failed execve() each), and the full path is remembered, so running it again goes straight
+    to the program. The table is thrown away when $PATH changes, or with "hash -r".
+    Commands found through a relative $PATH entry ("", ".", "bin") aren't remembered, since after a cd
+    the same name means a different program. Neither is anything found after checking one, as a cd
+    could put the command in that directory.
+*/
+
+#ifndef PATH_HASH_H
+#define PATH_HASH_H
+
+typedef struct path_entry
+{
+    char *name; // command as typed, NULL marks an empty slot
+    char *path; // where it was found
+    int hits;   // times it was looked up
+} path_entry;
+
+typedef struct path_hash
+{
+    path_entry *slots; // open addressing, always 0 or a power of two of them
+    int count;         // slots in use
+    int max;           // number of slots
+    char *path_var;    // copy of $PATH when the table was filled, to notice when it changes
+    char *uncached;    // last path found past a relative $PATH entry, kept only until the next lookup
+} phash;
+
+/* Set up an empty table */
+void init_path_hash(phash *h);
+
+/*
+    Returns the full path of the given command, NULL if it isn't on $PATH. Anything with a '/' in it is
+    already a path and is returned as it is. The result is valid until the table next changes, or
+    until the next lookup if it wasn't remembered.
+*/
+char *find_command(phash *h, char *name);
+
+/* Forget where the given command is (it moved, or was deleted) */
+void forget_command(phash *h, char *name);
+
+/* Forget everything ("hash -r") */
+void clear_path_hash(phash *h);
+
+/* Print every remembered command with its hit count ("hash") */
+void print_path_hash(phash *h);
+
+#endif
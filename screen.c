@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "screen.h"
+
+// back up the cursor count columns, whichever way is fewer bytes
+static void cursor_back(int count)
+{
+    if (count <= 3)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            putchar('\b');
+        }
+    }
+    else
+    {
+        printf("\33[%dD", count);
+    }
+}
+
+void init_screen(sline *screen)
+{
+    init_string(&(screen->shown));
+}
+
+void reset_screen(sline *screen)
+{
+    copy_string(&(screen->shown), "");
+}
+
+void show(sline *screen, char *text)
+{
+    char *old = as_cstring(&(screen->shown));
+    int old_length = screen->shown.size;
+    int new_length = strlen(text);
+    int same = 0;
+    while (same < old_length && same < new_length && old[same] == text[same])
+    {
+        same++;
+    }
+    if (same == old_length && same == new_length)
+    {
+        return;
+    }
+
+    cursor_back(old_length - same);
+    fputs(text + same, stdout);
+    int leftover = old_length - new_length;
+    if (leftover > 0)
+    {
+        // a backspace or two is cheaper to rub out with spaces than with an escape sequence
+        if (leftover <= 2)
+        {
+            for (int i = 0; i < leftover; i++)
+            {
+                putchar(' ');
+            }
+            cursor_back(leftover);
+        }
+        else
+        {
+            fputs("\33[K", stdout); // erase to the end of the line
+        }
+    }
+    copy_string(&(screen->shown), text);
+}
@@ -0,0 +1,31 @@
+/*
+    Keeps track of what the command line currently shows after the prompt, so changing it (scrolling
+    history, an auto-complete suggestion, a backspace) only sends the terminal what actually changed:
+    the cursor backs up to where the old and new lines stop agreeing, the rest of the new line is
+    written, and anything left over from the old one is erased. Scrolling between two long commands
+    that start the same way costs a few bytes rather than the prompt plus both whole commands.
+    Everything goes through stdout, which the shell gives a buffer big enough that one batch of keys
+    ends up as one write() (next_key() flushes before it reads).
+    Assumes the cursor is always at the end of the line and the line fits on one row of the terminal.
+*/
+
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include "dstring.h"
+
+typedef struct screen_line
+{
+    dstring shown; // what's on the terminal after the prompt
+} sline;
+
+/* Set up a screen line with nothing shown */
+void init_screen(sline *screen);
+
+/* A new prompt has just been printed, so nothing is shown after it */
+void reset_screen(sline *screen);
+
+/* Change the line on the terminal to show text, sending only the difference */
+void show(sline *screen, char *text);
+
+#endif
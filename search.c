@@ -0,0 +1,486 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "search.h"
+
+// how a match is ranked. How tight the match is matters most, then recency, then frequency
+#define SUBSTRING 3000   // the query appears as is
+#define SPREAD 2000      // the query's characters are spread out, less 20 per character in between
+#define AT_START 600     // the match starts the entry
+#define AT_WORD 300      // the match starts a word
+#define RECENCY 1000     // the newest entry gets all of this, the oldest next to none
+#define FREQUENCY 150    // per doubling of the number of times the command was run
+#define MAX_FREQUENCY 900
+
+// bit (c & 63) for each char c in v
+static unsigned long long mask_of(char *v)
+{
+    unsigned long long mask = 0;
+    for (; *v != '\0'; v++)
+    {
+        mask |= 1ULL << (*v & 63);
+    }
+    return mask;
+}
+
+// position in the per entry arrays of history index index. The index is up to date whenever this is used,
+// so its first entry is the history's first entry
+#define entry(s, index) ((index) + (s)->first - (s)->origin)
+
+// slot of the table holding the newest copy of the entry with sequence number seq, or the empty slot it
+// would go in. The entry has to still be in the history
+static int probe(hsearch *s, int seq)
+{
+    int e = seq - s->origin;
+    char *v = get(s->history, seq - s->history->first_seq);
+    int slot = s->hashes[e] & (s->table_size - 1);
+    while (s->table[slot] != -1)
+    {
+        int other = s->table[slot] - s->origin;
+        if (s->hashes[other] == s->hashes[e] && s->masks[other] == s->masks[e] &&
+            !strcmp(get(s->history, s->table[slot] - s->history->first_seq), v))
+        {
+            break;
+        }
+        slot = (slot + 1) & (s->table_size - 1);
+    }
+    return slot;
+}
+
+// slot of the table standing for seq, an entry that's already gone from the front of the history: its
+// own if it was the newest copy, otherwise its newest copy's. Its text is gone with it, so the newest
+// copy is known by having the same hash and mask (96 bits of the same, for two different commands).
+static int dropped_slot(hsearch *s, int seq)
+{
+    int e = seq - s->origin;
+    int slot = s->hashes[e] & (s->table_size - 1);
+    while (s->table[slot] != -1)
+    {
+        int other = s->table[slot] - s->origin;
+        if (s->table[slot] == seq || (s->hashes[other] == s->hashes[e] && s->masks[other] == s->masks[e]))
+        {
+            return slot;
+        }
+        slot = (slot + 1) & (s->table_size - 1);
+    }
+    return -1;
+}
+
+// put seq in the first empty slot from its hash on, it's known not to be in the table already
+static void place(hsearch *s, int seq)
+{
+    int slot = s->hashes[seq - s->origin] & (s->table_size - 1);
+    while (s->table[slot] != -1)
+    {
+        slot = (slot + 1) & (s->table_size - 1);
+    }
+    s->table[slot] = seq;
+}
+
+// put every newest copy back into a table twice the size
+static void grow_table(hsearch *s)
+{
+    free(s->table);
+    s->table_size = s->table_size == 0 ? 64 : s->table_size * 2;
+    s->table = malloc(sizeof(int) * s->table_size);
+    memset(s->table, -1, sizeof(int) * s->table_size);
+    for (int seq = s->first; seq < s->next; seq++)
+    {
+        if (s->counts[seq - s->origin] > 0)
+        {
+            place(s, seq);
+        }
+    }
+}
+
+// take seq, the oldest entry in the index, out of it
+static void drop_oldest(hsearch *s, int seq)
+{
+    int slot = dropped_slot(s, seq);
+    if (slot == -1)
+    {
+        return;
+    }
+    if (s->table[slot] != seq)
+    {
+        s->counts[s->table[slot] - s->origin]--; // one less copy of the newest
+        return;
+    }
+    // it was the only copy left. Put back everything after the hole up to the next empty slot, some of it
+    // may have probed past it
+    s->table[slot] = -1;
+    s->table_used--;
+    for (int j = (slot + 1) & (s->table_size - 1); s->table[j] != -1; j = (j + 1) & (s->table_size - 1))
+    {
+        int moved = s->table[j];
+        s->table[j] = -1;
+        place(s, moved);
+    }
+}
+
+// make room in the per entry arrays for sequence numbers up to end (not included)
+static void make_room(hsearch *s, int end)
+{
+    if (end - s->origin <= s->index_max)
+    {
+        return;
+    }
+    // once most of the room is taken up by entries dropped from the front, slide the rest down over them
+    // instead of growing. The table holds sequence numbers, so it doesn't notice
+    int live = s->next - s->first;
+    if (s->first - s->origin >= s->index_max / 2)
+    {
+        memmove(s->masks, s->masks + (s->first - s->origin), sizeof(unsigned long long) * live);
+        memmove(s->hashes, s->hashes + (s->first - s->origin), sizeof(unsigned int) * live);
+        memmove(s->counts, s->counts + (s->first - s->origin), sizeof(int) * live);
+        s->origin = s->first;
+    }
+    if (end - s->origin > s->index_max)
+    {
+        s->index_max = 2 * (end - s->origin);
+        s->masks = realloc(s->masks, sizeof(unsigned long long) * s->index_max);
+        s->hashes = realloc(s->hashes, sizeof(unsigned int) * s->index_max);
+        s->counts = realloc(s->counts, sizeof(int) * s->index_max);
+    }
+}
+
+int index_history(hsearch *s, llist *history, int max)
+{
+    int end = history->first_seq + history->length;
+    if (s->history != history || history->first_seq < s->first || end < s->next)
+    {
+        // a different history altogether, or one that went back on itself. Index it from scratch
+        s->history = history;
+        s->first = s->next = s->origin = history->first_seq;
+        s->table_used = 0;
+        if (s->table_size > 0)
+        {
+            memset(s->table, -1, sizeof(int) * s->table_size);
+        }
+    }
+
+    // entries dropped from the front (TWOSHELL_HISTSIZE) since last time
+    while (s->first < history->first_seq && s->first < s->next)
+    {
+        drop_oldest(s, s->first++);
+    }
+    if (s->next < history->first_seq)
+    {
+        s->first = s->next = history->first_seq; // ones that came and went in between never got indexed
+    }
+
+    // entries added to the end since last time, up to max of them. Room in the table for every one of
+    // them being different, so it doesn't have to grow part way through
+    if (end - s->next > max)
+    {
+        end = s->next + max;
+    }
+    make_room(s, end);
+    while (2 * (s->table_used + end - s->next) > s->table_size)
+    {
+        grow_table(s);
+    }
+    for (; s->next < end; s->next++)
+    {
+        int seq = s->next;
+        int e = seq - s->origin;
+        char *v = get(history, seq - history->first_seq);
+        unsigned long long mask = 0;
+        unsigned int h = 2166136261u;
+        for (char *c = v; *c != '\0'; c++)
+        {
+            mask |= 1ULL << (*c & 63);
+            h = (h ^ (unsigned char)*c) * 16777619u; // FNV-1a
+        }
+        s->masks[e] = mask;
+        s->hashes[e] = h;
+        int slot = probe(s, seq);
+        if (s->table[slot] == -1)
+        {
+            s->counts[e] = 1;
+            s->table_used++;
+        }
+        else
+        {
+            // the older copy isn't offered any more, this one carries its count
+            s->counts[e] = s->counts[s->table[slot] - s->origin] + 1;
+            s->counts[s->table[slot] - s->origin] = 0;
+        }
+        s->table[slot] = seq;
+    }
+    return s->next < history->first_seq + history->length;
+}
+
+// scores candidate i (entry v), whose match has already been found
+static void rank(hsearch *s, int i, char *v)
+{
+    int index = s->candidates[i];
+    int start;
+    int score;
+    if (s->substrings[i] != -1)
+    {
+        start = s->substrings[i];
+        score = SUBSTRING;
+    }
+    else
+    {
+        start = s->firsts[i];
+        int spread = s->ends[i] - s->firsts[i] - s->query.size; // characters in between the matched ones
+        score = SPREAD - (spread < 50 ? 20 * spread : 1000);
+    }
+    if (start == 0)
+    {
+        score += AT_START;
+    }
+    else if (v[start - 1] == ' ' || v[start - 1] == '/')
+    {
+        score += AT_WORD;
+    }
+
+    score += (long long)RECENCY * (index + 1) / s->history->length;
+    int frequency = 0;
+    for (int runs = s->counts[entry(s, index)]; runs > 1 && frequency < MAX_FREQUENCY; runs /= 2)
+    {
+        frequency += FREQUENCY;
+    }
+    s->scores[i] = score + frequency;
+}
+
+// point current at the best candidate, ties go to the newest (which comes first)
+static void pick_best(hsearch *s)
+{
+    s->current = -1;
+    for (int i = 0; i < s->candidate_count; i++)
+    {
+        if (s->current == -1 || s->scores[i] > s->scores[s->current])
+        {
+            s->current = i;
+        }
+    }
+}
+
+// match the whole query against every (different) entry in the history
+static void match_all(hsearch *s)
+{
+    char *q = as_cstring(&(s->query));
+    int q_length = s->query.size;
+    unsigned long long q_mask = mask_of(q);
+
+    s->candidate_count = 0;
+    unsigned long long *masks = s->masks + entry(s, 0);
+    int *counts = s->counts + entry(s, 0);
+    for (int index = s->next - s->first - 1; index >= 0; index--)
+    {
+        // an entry missing any of the query's characters can't match, and most of them are caught here
+        // without touching the entry itself
+        if ((masks[index] & q_mask) != q_mask || counts[index] == 0)
+        {
+            continue;
+        }
+        // each char of the query as early as it can go, strchr does the looking (and libc's strchr
+        // checks a whole vector register of the entry at a time)
+        char *v = get(s->history, index);
+        char *p = v;
+        char *first = NULL;
+        for (int i = 0; i < q_length && p != NULL; i++)
+        {
+            if ((p = strchr(p, q[i])) != NULL)
+            {
+                first = i == 0 ? p : first;
+                p++;
+            }
+        }
+        if (p == NULL)
+        {
+            continue;
+        }
+        int i = s->candidate_count++;
+        s->candidates[i] = index;
+        s->firsts[i] = first - v;
+        s->ends[i] = p - v;
+        if (p - first == q_length)
+        {
+            s->substrings[i] = first - v;
+        }
+        else
+        {
+            // the earliest match is spread out, but the query might still be in there as is further on
+            char *found = strstr(first + 1, q);
+            s->substrings[i] = found == NULL ? -1 : found - v;
+        }
+        rank(s, i, v);
+    }
+    pick_best(s);
+}
+
+void init_search(hsearch *s)
+{
+    s->history = NULL;
+    init_string(&(s->query));
+    s->masks = NULL;
+    s->hashes = NULL;
+    s->counts = NULL;
+    s->origin = 0;
+    s->index_max = 0;
+    s->first = 0;
+    s->next = 0;
+    s->table = NULL;
+    s->table_size = 0;
+    s->table_used = 0;
+    s->candidates = NULL;
+    s->firsts = NULL;
+    s->ends = NULL;
+    s->substrings = NULL;
+    s->scores = NULL;
+    s->candidate_count = 0;
+    s->current = -1;
+}
+
+void start_search(hsearch *s, llist *history)
+{
+    end_search(s);
+    index_history(s, history, history->length); // nothing to do if the shell has kept it up to date
+    int length = history->length + 1;
+    s->candidates = malloc(sizeof(int) * length);
+    s->firsts = malloc(sizeof(int) * length);
+    s->ends = malloc(sizeof(int) * length);
+    s->substrings = malloc(sizeof(int) * length);
+    s->scores = malloc(sizeof(int) * length);
+}
+
+void search_add(hsearch *s, char c)
+{
+    add_end(&(s->query), c);
+    if (s->query.size == 1)
+    {
+        match_all(s);
+        return;
+    }
+
+    // anything matching the longer query matched the shorter one, and its earliest match is the
+    // shorter one's carried on by one more char
+    char *q = as_cstring(&(s->query));
+    int q_length = s->query.size;
+    unsigned long long c_bit = 1ULL << (c & 63);
+    int kept = 0;
+    for (int i = 0; i < s->candidate_count; i++)
+    {
+        int index = s->candidates[i];
+        if ((s->masks[entry(s, index)] & c_bit) == 0)
+        {
+            continue;
+        }
+        char *v = get(s->history, index);
+        char *p = strchr(v + s->ends[i], c);
+        if (p == NULL)
+        {
+            continue;
+        }
+        // kept never gets ahead of i, so this can be done in place
+        s->candidates[kept] = index;
+        s->firsts[kept] = s->firsts[i];
+        s->ends[kept] = p - v + 1;
+        s->substrings[kept] = s->substrings[i];
+        if (s->substrings[kept] != -1 && v[s->substrings[kept] + q_length - 1] != c)
+        {
+            char *found = strstr(v + s->substrings[kept] + 1, q);
+            s->substrings[kept] = found == NULL ? -1 : found - v;
+        }
+        rank(s, kept, v);
+        kept++;
+    }
+    s->candidate_count = kept;
+    pick_best(s);
+}
+
+void search_delete(hsearch *s)
+{
+    if (s->query.size == 0)
+    {
+        return;
+    }
+    remove_dstring_index(&(s->query), s->query.size - 1);
+    if (s->query.size == 0)
+    {
+        s->candidate_count = 0;
+        s->current = -1;
+        return;
+    }
+    // the candidates that were ruled out might match again, start over
+    match_all(s);
+}
+
+void search_next(hsearch *s)
+{
+    if (s->current == -1)
+    {
+        return;
+    }
+    // the best candidate ranked below the current one: a lower score, or the same score but older
+    int current_score = s->scores[s->current];
+    int next = -1;
+    for (int i = 0; i < s->candidate_count; i++)
+    {
+        int below = s->scores[i] < current_score || (s->scores[i] == current_score && i > s->current);
+        if (below && (next == -1 || s->scores[i] > s->scores[next]))
+        {
+            next = i;
+        }
+    }
+    if (next != -1)
+    {
+        s->current = next;
+    }
+}
+
+int search_match(hsearch *s)
+{
+    return s->current == -1 ? -1 : s->candidates[s->current];
+}
+
+// add text to the end of line
+static void add_text(dstring *line, char *text)
+{
+    for (; *text != '\0'; text++)
+    {
+        add_end(line, *text);
+    }
+}
+
+void search_line(hsearch *s, dstring *line)
+{
+    copy_string(line, "(search)`");
+    add_text(line, as_cstring(&(s->query)));
+    add_text(line, "': ");
+    if (s->current != -1)
+    {
+        add_text(line, get(s->history, s->candidates[s->current]));
+    }
+}
+
+void end_search(hsearch *s)
+{
+    free(s->candidates);
+    free(s->firsts);
+    free(s->ends);
+    free(s->substrings);
+    free(s->scores);
+    s->candidates = NULL;
+    s->firsts = NULL;
+    s->ends = NULL;
+    s->substrings = NULL;
+    s->scores = NULL;
+    s->candidate_count = 0;
+    s->current = -1;
+    clear_string(&(s->query));
+}
+
+void free_search(hsearch *s)
+{
+    end_search(s);
+    free(s->masks);
+    free(s->hashes);
+    free(s->counts);
+    free(s->table);
+    init_search(s);
+}
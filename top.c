@@ -0,0 +1,353 @@
+#define _GNU_SOURCE // CLOCK_BOOTTIME, ppoll
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "top.h"
+#include "jobs.h"
+
+static char *top_usage_msg = "usage: top [-d seconds] [-n samples]";
+
+static long long boot_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// p, moved on past n space separated fields
+static char *skip_fields(char *p, int n)
+{
+    for (; n > 0 && *p != '\0'; n--)
+    {
+        while (*p != ' ' && *p != '\0')
+        {
+            p++;
+        }
+        while (*p == ' ')
+        {
+            p++;
+        }
+    }
+    return p;
+}
+
+// the number after "name:" in a /proc file of "name: value" lines, starting the search at p
+static long long field_value(char *p, char *name)
+{
+    char *found = strstr(p, name);
+    return found == NULL ? 0 : strtoll(found + strlen(name), NULL, 10);
+}
+
+int open_sample(psample *p, pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    p->pid = pid;
+    p->stat_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (p->stat_fd == -1)
+    {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    p->io_fd = open(path, O_RDONLY | O_CLOEXEC);
+    p->cpu_percent = -1;
+    p->cpu_ticks = -1;
+    if (!take_sample(p))
+    {
+        close_sample(p);
+        return 0;
+    }
+    return 1;
+}
+
+int take_sample(psample *p)
+{
+    // one read of the whole file from the start, /proc makes it up fresh each time
+    char buf[1024];
+    ssize_t n = pread(p->stat_fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0)
+    {
+        return 0;
+    }
+    buf[n] = '\0';
+    long long now = boot_ns();
+
+    // "pid (name) state ...", the name can have anything in it (spaces, parentheses), so it ends at
+    // the last ')'. state is field 3, the ones after it are numbered from there.
+    char *open_paren = strchr(buf, '(');
+    char *close_paren = strrchr(buf, ')');
+    if (open_paren == NULL || close_paren == NULL || close_paren[1] == '\0')
+    {
+        return 0;
+    }
+    int length = close_paren - open_paren - 1;
+    if (length > (int)sizeof(p->command) - 1)
+    {
+        length = sizeof(p->command) - 1;
+    }
+    memcpy(p->command, open_paren + 1, length);
+    p->command[length] = '\0';
+
+    char *field = close_paren + 2;
+    p->state = *field;
+    field = skip_fields(field, 14 - 3);
+    char *end;
+    long long utime = strtoll(field, &end, 10); // 14
+    long long stime = strtoll(end, &end, 10);   // 15
+    field = skip_fields(end + 1, 22 - 16);
+    p->start_ticks = strtoll(field, &end, 10);  // 22
+    field = skip_fields(end + 1, 24 - 23);
+    p->rss_kb = strtoll(field, NULL, 10) * (sysconf(_SC_PAGESIZE) / 1024); // 24, in pages
+
+    long long cpu_ticks = utime + stime;
+    if (p->cpu_ticks != -1 && now > p->sampled_ns)
+    {
+        double cpu_ns = (cpu_ticks - p->cpu_ticks) * 1e9 / sysconf(_SC_CLK_TCK);
+        p->cpu_percent = 100 * cpu_ns / (now - p->sampled_ns);
+    }
+    p->cpu_ticks = cpu_ticks;
+    p->sampled_ns = now;
+
+    // rchar and wchar are the first two lines, they count pipes too (read_bytes/write_bytes further
+    // down only count the disk), which is what shows data moving through a pipeline
+    if (p->io_fd != -1 && (n = pread(p->io_fd, buf, sizeof(buf) - 1, 0)) > 0)
+    {
+        buf[n] = '\0';
+        p->read_bytes = field_value(buf, "rchar:");
+        p->written_bytes = field_value(buf, "wchar:");
+    }
+    else
+    {
+        p->read_bytes = 0;
+        p->written_bytes = 0;
+    }
+    return 1;
+}
+
+void close_sample(psample *p)
+{
+    close(p->stat_fd);
+    if (p->io_fd != -1)
+    {
+        close(p->io_fd);
+    }
+    p->stat_fd = -1;
+    p->io_fd = -1;
+}
+
+// bytes in 7 characters: 123B, 12.3K, 1.2G ...
+static void print_size(long long bytes)
+{
+    char *units = "BKMGT";
+    double size = bytes;
+    int unit = 0;
+    while (size >= 1024 && unit < 4)
+    {
+        size /= 1024;
+        unit++;
+    }
+    if (unit == 0)
+    {
+        printf(" %6lldB", bytes);
+    }
+    else
+    {
+        printf(" %6.1f%c", size, units[unit]);
+    }
+}
+
+// seconds as m:ss, or h:mm:ss once it's been an hour
+static void print_elapsed(long long seconds)
+{
+    if (seconds >= 3600)
+    {
+        printf(" %3lld:%02lld:%02lld\n", seconds / 3600, seconds / 60 % 60, seconds % 60);
+    }
+    else
+    {
+        printf(" %6lld:%02lld\n", seconds / 60, seconds % 60);
+    }
+}
+
+// wait ms milliseconds. Returns 1 if enter was pressed (or CTRL-C) meanwhile, and the user is done.
+// Once stdin is at EOF (a batch run from a file, say) there's nobody to press enter, so it stops being
+// watched and this just waits
+static int interrupted(int ms, int *watch_stdin)
+{
+    // a job finishing would interrupt the wait too. SIGCHLD is held off until it's over instead, so only
+    // CTRL-C does
+    sigset_t mask;
+    sigprocmask(SIG_BLOCK, NULL, &mask);
+    sigaddset(&mask, SIGCHLD);
+    long long until = boot_ns() + ms * 1000000LL;
+    long long left;
+    while ((left = until - boot_ns()) > 0)
+    {
+        struct pollfd in = {STDIN_FILENO, POLLIN, 0};
+        struct timespec timeout = {left / 1000000000LL, left % 1000000000LL};
+        int ready = ppoll(&in, *watch_stdin, &timeout, &mask);
+        if (ready == -1)
+        {
+            return errno == EINTR;
+        }
+        if (ready == 1)
+        {
+            char discard[256];
+            if (read(STDIN_FILENO, discard, sizeof(discard)) > 0)
+            {
+                return 1;
+            }
+            *watch_stdin = 0;
+        }
+    }
+    return 0;
+}
+
+// CTRL-C while top is running just has to interrupt the wait
+static void stop_top(int signo)
+{
+}
+
+int top(char **argv)
+{
+    double interval = 1;
+    int samples = -1; // until the jobs are done
+    for (int i = 1; argv[i] != NULL; i++)
+    {
+        if (argv[i + 1] != NULL && !strcmp(argv[i], "-d") && (interval = atof(argv[i + 1])) > 0)
+        {
+            i++;
+        }
+        else if (argv[i + 1] != NULL && !strcmp(argv[i], "-n") && (samples = atoi(argv[i + 1])) > 0)
+        {
+            i++;
+        }
+        else
+        {
+            fprintf(stderr, "%s\n", top_usage_msg);
+            return 1;
+        }
+    }
+
+    // the shell's own SIGINT handler toggles auto-complete, CTRL-C here is only meant to stop top
+    struct sigaction stop;
+    struct sigaction saved;
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = stop_top;
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGINT, &stop, &saved);
+
+    int max = 16;
+    jproc *procs = malloc(sizeof(jproc) * max);
+    psample *watched = malloc(sizeof(psample) * max);
+    int watched_count = 0;
+    long long ticks = sysconf(_SC_CLK_TCK);
+    int clear = isatty(STDOUT_FILENO);
+    int watch_stdin = 1;
+
+    for (int printed = 0; samples == -1 || printed < samples; printed++)
+    {
+        int count;
+        while ((count = job_processes(procs, max)) > max)
+        {
+            // watched has to hold every one of them too, and it only ever holds processes in procs
+            max = count * 2;
+            procs = realloc(procs, sizeof(jproc) * max);
+            watched = realloc(watched, sizeof(psample) * max);
+        }
+        if (count == 0)
+        {
+            if (printed == 0)
+            {
+                printf("no background jobs running\n");
+            }
+            break;
+        }
+
+        // keep watching the ones still there, start on the new ones, and let go of the rest. Both lists
+        // are in job table order, so a new process can go where its sample should be
+        psample *old = malloc(sizeof(psample) * (watched_count > 0 ? watched_count : 1));
+        memcpy(old, watched, sizeof(psample) * watched_count);
+        int old_count = watched_count;
+        watched_count = 0;
+        for (int i = 0; i < count; i++)
+        {
+            int found = -1;
+            for (int k = 0; k < old_count && found == -1; k++)
+            {
+                found = old[k].pid == procs[i].pid ? k : -1;
+            }
+            if (found != -1)
+            {
+                watched[i] = old[found];
+                old[found].pid = -1;
+            }
+            else if (!open_sample(&watched[i], procs[i].pid))
+            {
+                watched[i].pid = -1; // exited since the job table was looked at
+            }
+        }
+        watched_count = count;
+        for (int k = 0; k < old_count; k++)
+        {
+            if (old[k].pid != -1)
+            {
+                close_sample(&old[k]);
+            }
+        }
+        free(old);
+
+        // CPU use is over the interval, so nothing is printed until there's been one
+        fflush(stdout);
+        if (interrupted(interval * 1000, &watch_stdin))
+        {
+            break;
+        }
+
+        if (clear)
+        {
+            printf("\033[H\033[J");
+        }
+        printf("every %.1fs, enter to stop\n", interval);
+        printf("JOB   STAGE   PID      COMMAND          S   CPU%%     RSS    READ WRITTEN  ELAPSED\n");
+        long long now_ticks = boot_ns() / (1000000000LL / ticks);
+        for (int i = 0; i < watched_count; i++)
+        {
+            psample *p = &watched[i];
+            if (p->pid == -1 || !take_sample(p))
+            {
+                continue;
+            }
+            printf("[%d]%*s %3d/%-3d %-8d %-15s  %c %6.1f", procs[i].id, procs[i].id < 10 ? 2 : 1, "",
+                   procs[i].stage + 1, procs[i].stages, (int)p->pid, p->command, p->state,
+                   p->cpu_percent < 0 ? 0 : p->cpu_percent);
+            print_size(p->rss_kb * 1024);
+            print_size(p->read_bytes);
+            print_size(p->written_bytes);
+            print_elapsed((now_ticks - p->start_ticks) / ticks);
+        }
+        if (!clear)
+        {
+            printf("\n");
+        }
+    }
+
+    for (int i = 0; i < watched_count; i++)
+    {
+        if (watched[i].pid != -1)
+        {
+            close_sample(&watched[i]);
+        }
+    }
+    free(watched);
+    free(procs);
+    sigaction(SIGINT, &saved, NULL);
+    return 0;
+}
@@ -0,0 +1,48 @@
+/*
+    Built in command: top. Watches the processes of the shell's background jobs (every stage of every
+    pipeline started with &) and lists, for each one, how much CPU it's using, its memory, how much it
+    has read and written, and how long it has been running. In a long pipeline, the stage using all of a
+    CPU while the others sit waiting is the one holding it up.
+    Everything comes out of /proc/<pid>/stat and /proc/<pid>/io. Each process's files are opened once
+    and just read again from the start for every sample, and only the fields that are shown get parsed.
+    Keeping them open also means a pid that gets reused after its process is reaped can't be mistaken
+    for it, the old files just stop being readable.
+*/
+
+#ifndef TOP_H
+#define TOP_H
+
+#include <sys/types.h> // pid_t
+
+typedef struct proc_sample
+{
+    pid_t pid;
+    int stat_fd;             // /proc/<pid>/stat
+    int io_fd;               // /proc/<pid>/io, -1 if it couldn't be opened
+    char command[16];        // the program's name, as the kernel has it
+    char state;              // R running, S/D waiting, T stopped, Z exited
+    long long start_ticks;   // when it started, in clock ticks since boot
+    long long cpu_ticks;     // user + system time so far
+    long long rss_kb;        // memory in use
+    long long read_bytes;    // read so far, pipes and terminals included. 0 if io_fd is -1
+    long long written_bytes; // same for writes
+    long long sampled_ns;    // CLOCK_BOOTTIME of the sample
+    double cpu_percent;      // of one CPU between the last two samples, -1 until there have been two
+} psample;
+
+/* Start watching pid and take the first sample. Returns 0 if there's no such process. */
+int open_sample(psample *p, pid_t pid);
+
+/* Sample it again. Returns 0 if the process is gone. */
+int take_sample(psample *p);
+
+/* Stop watching */
+void close_sample(psample *p);
+
+/*
+    Built in command: top [-d seconds] [-n samples]. Prints the table every seconds (1) until it's been
+    printed samples times, every job has finished, or enter is pressed.
+*/
+int top(char **argv);
+
+#endif
@@ -0,0 +1,181 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define TRACE_RING_SIZE 4096 // records, a power of two
+#define TRACE_TEXT 48        // bytes of text kept per record, longer text is cut off
+
+typedef struct trace_record
+{
+    atomic_int ready; // set once the record is filled in, cleared once it's written out
+    int event;
+    pid_t pid;
+    long long ns;
+    long long a;
+    long long b;
+    char text[TRACE_TEXT];
+} trecord;
+
+// what each event's fields are called in the output, NULL for fields it doesn't use
+static struct
+{
+    char *name;
+    char *a;
+    char *b;
+    char *text;
+} formats[] = {
+    {"parse_start", NULL, NULL, "line"},
+    {"parse_end", "tokens", NULL, NULL},
+    {"pipe", "read_fd", "write_fd", NULL},
+    {"redirect", "fd", NULL, "path"},
+    {"spawn", "spawn_ns", NULL, "command"},
+    {"fork", "fork_ns", NULL, "command"},
+    {"builtin", "status", "run_ns", "command"},
+    {"wait", "status", NULL, NULL},
+    {"reap", "status", NULL, NULL},
+};
+
+static FILE *trace_file = NULL;
+static trecord *ring = NULL;
+static atomic_uint head;    // next slot to claim
+static atomic_uint tail;    // next slot to write out
+static atomic_uint dropped; // records that didn't fit
+
+// JSON string, quotes and all
+static void write_string(char *s)
+{
+    putc('"', trace_file);
+    for (; *s != '\0'; s++)
+    {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+        {
+            putc('\\', trace_file);
+            putc(c, trace_file);
+        }
+        else if (c < 0x20)
+        {
+            fprintf(trace_file, "\\u%04x", c);
+        }
+        else
+        {
+            putc(c, trace_file);
+        }
+    }
+    putc('"', trace_file);
+}
+
+static void close_trace(void)
+{
+    flush_trace();
+    if (atomic_load(&dropped) > 0)
+    {
+        fprintf(trace_file, "{\"ns\":%lld,\"event\":\"dropped\",\"records\":%u}\n", trace_clock(),
+                atomic_load(&dropped));
+    }
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+int open_trace(char *path)
+{
+    trace_file = fopen(path, "we");
+    if (trace_file == NULL)
+    {
+        perror(path);
+        return 0;
+    }
+    setvbuf(trace_file, NULL, _IOFBF, 1 << 16);
+    ring = calloc(TRACE_RING_SIZE, sizeof(trecord));
+    atexit(close_trace);
+    return 1;
+}
+
+int tracing(void)
+{
+    return trace_file != NULL;
+}
+
+long long trace_clock(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void trace_event(enum trace_event event, pid_t pid, long long a, long long b, char *text)
+{
+    if (ring == NULL)
+    {
+        return;
+    }
+    // claim a slot. Nothing here blocks, so the SIGCHLD handler can interrupt the shell half way
+    // through adding a record and add its own, and both end up in the ring
+    unsigned int slot = atomic_load(&head);
+    do
+    {
+        if (slot - atomic_load(&tail) >= TRACE_RING_SIZE)
+        {
+            atomic_fetch_add(&dropped, 1);
+            return;
+        }
+    } while (!atomic_compare_exchange_weak(&head, &slot, slot + 1));
+
+    trecord *r = &ring[slot & (TRACE_RING_SIZE - 1)];
+    r->event = event;
+    r->pid = pid;
+    r->ns = trace_clock();
+    r->a = a;
+    r->b = b;
+    r->text[0] = '\0';
+    if (text != NULL)
+    {
+        strncat(r->text, text, TRACE_TEXT - 1);
+    }
+    atomic_store_explicit(&(r->ready), 1, memory_order_release);
+}
+
+void flush_trace(void)
+{
+    if (ring == NULL)
+    {
+        return;
+    }
+    unsigned int slot = atomic_load(&tail);
+    // in the order they were claimed. One that was claimed but isn't filled in yet holds up the rest
+    // until next time
+    while (1)
+    {
+        trecord *r = &ring[slot & (TRACE_RING_SIZE - 1)];
+        if (!atomic_load_explicit(&(r->ready), memory_order_acquire))
+        {
+            break;
+        }
+        fprintf(trace_file, "{\"ns\":%lld,\"event\":\"%s\"", r->ns, formats[r->event].name);
+        if (r->pid > 0)
+        {
+            fprintf(trace_file, ",\"pid\":%d", (int)r->pid);
+        }
+        if (formats[r->event].a != NULL)
+        {
+            fprintf(trace_file, ",\"%s\":%lld", formats[r->event].a, r->a);
+        }
+        if (formats[r->event].b != NULL)
+        {
+            fprintf(trace_file, ",\"%s\":%lld", formats[r->event].b, r->b);
+        }
+        if (formats[r->event].text != NULL)
+        {
+            fprintf(trace_file, ",\"%s\":", formats[r->event].text);
+            write_string(r->text);
+        }
+        fputs("}\n", trace_file);
+        atomic_store_explicit(&(r->ready), 0, memory_order_relaxed);
+        slot++;
+        atomic_store_explicit(&tail, slot, memory_order_release);
+    }
+}
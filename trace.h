@@ -0,0 +1,50 @@
+/*
+    Tracing, to see where the time between commands goes. Turned on with "-t file" or TWOSHELL_TRACE=file,
+    it writes one JSON object per line to file for everything the shell does on the way to running a
+    command and back:
+        {"ns":1234,"event":"spawn","pid":567,"spawn_ns":81000,"command":"ls"}
+    ns is CLOCK_MONOTONIC in nanoseconds. The events are parse_start/parse_end (tokenizing a line),
+    pipe (pipe creation), redirect (a file opened for < > or >>), spawn (posix_spawn, a fork and exec in
+    one), fork (a utility from builtins.h run as a pipeline stage), builtin (one run in the shell),
+    wait (a foreground process collected) and reap (a background one collected by the SIGCHLD handler).
+    trace_event() can be called from the SIGCHLD handler as well as the rest of the shell, so records go
+    into a lock-free ring rather than straight to the file: whoever's adding one claims a slot with an
+    atomic add and marks it ready when it's filled in. flush_trace() (never called from the handler)
+    copies the ready ones out through a big stdio buffer. If the ring fills up before it's flushed,
+    records are dropped and the count of them is written at the end.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <sys/types.h> // pid_t
+
+enum trace_event
+{
+    TRACE_PARSE_START, // text: the line
+    TRACE_PARSE_END,   // a: tokens
+    TRACE_PIPE,        // a: read end, b: write end
+    TRACE_REDIRECT,    // a: fd it lands on, text: file name
+    TRACE_SPAWN,       // pid, a: ns spent in posix_spawn, text: command
+    TRACE_FORK,        // pid, a: ns spent in fork, text: command
+    TRACE_BUILTIN,     // a: exit status, b: ns it took, text: command
+    TRACE_WAIT,        // pid, a: exit status
+    TRACE_REAP,        // pid, a: exit status
+};
+
+/* Start tracing to the file at path. Returns 0 if it couldn't be opened (and says why). */
+int open_trace(char *path);
+
+/* Returns 1 if tracing is on */
+int tracing(void);
+
+/* CLOCK_MONOTONIC in nanoseconds */
+long long trace_clock(void);
+
+/* Record an event (see trace_event above for what a, b and text are). Safe in a signal handler. */
+void trace_event(enum trace_event event, pid_t pid, long long a, long long b, char *text);
+
+/* Write out every record that's ready. Not safe in a signal handler. */
+void flush_trace(void);
+
+#endif
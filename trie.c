@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include "trie.h"
+
+#define edge_key(parent, c) ((((long long)(parent)) << 8 | (unsigned char)(c)) + 1)
+
+// old table slots moved over per character inserted. A table grows when it's half full, so the new one
+// takes half the old one's size in new edges before it's half full too, and the old one has to be empty
+// by then: at least 2 per edge, and every edge added is a character inserted
+#define MOVES_PER_CHAR 4
+
+// find the slot of the table keys (max slots) holding key, or the empty slot it would go in (linear probing)
+static int probe(long long *keys, int max, long long key)
+{
+    unsigned long long h = (unsigned long long)key * 0x9E3779B97F4A7C15ULL;
+    int i = (int)(h >> 32) & (max - 1);
+    while (keys[i] != 0 && keys[i] != key)
+    {
+        i = (i + 1) & (max - 1);
+    }
+    return i;
+}
+
+// move up to count more slots of the old table over to the new one. The old table is only ever read
+// until it's freed, so an edge that's been moved can still be found in it too, with the same child.
+static void move_edges(trie *t, int count)
+{
+    for (; count > 0 && t->old_keys != NULL; count--)
+    {
+        if (t->old_keys[t->moved] != 0)
+        {
+            int slot = probe(t->keys, t->edge_max, t->old_keys[t->moved]);
+            t->keys[slot] = t->old_keys[t->moved];
+            t->children[slot] = t->old_children[t->moved];
+        }
+        if (++(t->moved) == t->old_max)
+        {
+            free(t->old_keys);
+            free(t->old_children);
+            t->old_keys = NULL;
+            t->old_children = NULL;
+        }
+    }
+}
+
+// the child the edge key leads to, -1 if there's no such edge
+static int find_edge(trie *t, long long key)
+{
+    if (t->edge_max == 0)
+    {
+        return -1;
+    }
+    int slot = probe(t->keys, t->edge_max, key);
+    if (t->keys[slot] != 0)
+    {
+        return t->children[slot];
+    }
+    if (t->old_keys != NULL && t->old_keys[slot = probe(t->old_keys, t->old_max, key)] != 0)
+    {
+        return t->old_children[slot];
+    }
+    return -1;
+}
+
+// start moving the edges to a table twice the size
+static void grow_edges(trie *t)
+{
+    move_edges(t, t->old_max); // finish off the last grow, if it somehow isn't done yet
+    if (t->edge_max > 0)
+    {
+        t->old_keys = t->keys;
+        t->old_children = t->children;
+        t->old_max = t->edge_max;
+        t->moved = 0;
+    }
+    t->edge_max = t->edge_max == 0 ? 64 : t->edge_max * 2;
+    t->keys = calloc(t->edge_max, sizeof(long long));
+    t->children = malloc(sizeof(int) * t->edge_max);
+}
+
+static int new_node(trie *t)
+{
+    if (t->node_count == t->node_max)
+    {
+        t->node_max = t->node_max == 0 ? 64 : t->node_max * 2;
+        t->latest = realloc(t->latest, sizeof(int) * t->node_max);
+    }
+    t->latest[t->node_count] = -1;
+    return t->node_count++;
+}
+
+void init_trie(trie *t)
+{
+    t->latest = NULL;
+    t->node_count = 0;
+    t->node_max = 0;
+    t->keys = NULL;
+    t->children = NULL;
+    t->edge_count = 0;
+    t->edge_max = 0;
+    t->old_keys = NULL;
+    t->old_children = NULL;
+    t->old_max = 0;
+    t->moved = 0;
+    new_node(t); // root
+}
+
+void trie_insert(trie *t, char *value, int seq)
+{
+    int node = 0;
+    int made = t->node_count; // nodes from here on are new
+    if (seq > t->latest[node])
+    {
+        t->latest[node] = seq;
+    }
+    for (int i = 0; value[i] != '\0'; i++)
+    {
+        // keep the edge table at most half full so probes stay short
+        if (2 * (t->edge_count + 1) > t->edge_max)
+        {
+            grow_edges(t);
+        }
+        move_edges(t, MOVES_PER_CHAR);
+        long long key = edge_key(node, value[i]);
+        // a node made for this entry has no children yet, so past the first one there's nothing to look for
+        int child = node >= made ? -1 : find_edge(t, key);
+        if (child == -1)
+        {
+            int slot = probe(t->keys, t->edge_max, key);
+            t->keys[slot] = key;
+            t->children[slot] = child = new_node(t);
+            t->edge_count++;
+        }
+        node = child;
+        // the newest entry always wins, whichever order they're indexed in
+        if (seq > t->latest[node])
+        {
+            t->latest[node] = seq;
+        }
+    }
+}
+
+int trie_latest(trie *t, char *prefix)
+{
+    int node = 0;
+    for (int i = 0; prefix[i] != '\0' && node != -1; i++)
+    {
+        node = find_edge(t, edge_key(node, prefix[i]));
+    }
+    return node == -1 ? -1 : t->latest[node];
+}
+
+void free_trie(trie *t)
+{
+    free(t->latest);
+    free(t->keys);
+    free(t->children);
+    free(t->old_keys);
+    free(t->old_children);
+    t->latest = NULL;
+    t->keys = NULL;
+    t->children = NULL;
+    t->node_count = 0;
+    t->node_max = 0;
+    t->edge_count = 0;
+    t->edge_max = 0;
+    t->old_keys = NULL;
+    t->old_children = NULL;
+    t->old_max = 0;
+    t->moved = 0;
+}
@@ -0,0 +1,43 @@
+/*
+    Prefix index over the shell history, used by auto-complete mode.
+    Every node of the trie remembers the most recent entry that passes through it, so finding the most
+    recent history entry that starts with a given prefix is a single walk down the trie: O(prefix length).
+    Children are found through one hash table keyed by (parent node, char) rather than a 256 wide array
+    per node, which keeps the index small enough for very long histories. When the table fills up, the
+    edges move over to one twice the size a few at a time, with each new edge added, rather than all at
+    once: with a million entries that's tens of millions of edges, and moving them in one go would hold
+    up whatever insert it happened to land on for over a second.
+*/
+
+#ifndef TRIE_H
+#define TRIE_H
+
+typedef struct trie
+{
+    int *latest;      // per node: most recent entry (by sequence number) passing through it, -1 if none
+    int node_count;   // nodes in use, node 0 is the root
+    int node_max;     // available memory for nodes
+    long long *keys;  // edge table keys: (parent node << 8 | char) + 1, 0 marks an empty slot
+    int *children;    // edge table values: child node, parallel to keys
+    int edge_count;   // edges in use, counting ones still in the old table
+    int edge_max;     // slots in the edge table, always 0 or a power of two
+    long long *old_keys; // the edge table before it last grew, NULL once every edge has moved out of it
+    int *old_children;
+    int old_max;      // slots in the old table
+    int moved;        // slots of the old table moved over so far
+} trie;
+
+/* Set up an empty trie. Must be called before any other function is used on the trie. */
+void init_trie(trie *t);
+
+/* Index the given string as the entry with sequence number seq. Entries can go in in any order, the
+   highest sequence number through a node is the one it keeps. */
+void trie_insert(trie *t, char *value, int seq);
+
+/* Returns the sequence number of the most recent entry starting with prefix, -1 if there is none. */
+int trie_latest(trie *t, char *prefix);
+
+/* Release all memory associated with the trie. The trie can be reused after init_trie. */
+void free_trie(trie *t);
+
+#endif
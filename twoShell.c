@@ -1,9 +1,13 @@
 /**
  * twoShell is a mostly simple implementation of a Bash-style shell. That is, very few commands are
- * handled "in house" (in this case, on "cd", "exit", and "history"). All other commands are outsourced by
+ * handled "in house" (in this case, "cd", "exit", "history", "jobs", "fg", "bg", "top" and "hash"). All other commands are outsourced by
  * executing other programs in new processes.
  * twoShell supports redirections through >, >>, and <, running programs in the background using &,
- * and piping between ONLY two programs (that is, a single pipe.) 
+ * and piping between any number of programs (cat log | grep a | sort | uniq -c).
+ * A pipeline can start with "< file" or end with "> file" (or ">> file") on its own, with no program:
+ *      "< big.log | grep a | > matches". The shell moves the data between the file and the pipe itself,
+ *      with splice(), so it never gets copied through a process. "-p bytes" (or TWOSHELL_PIPE_SIZE)
+ *      makes the pipes between stages that big instead of 64K (up to 1M, unless you're root).
  * 
  * New Features!
  * Batch Mode: Text files can be processed as batch files by running twoShell in the following way:
@@ -11,45 +15,92 @@
  * 
  *      The shell will execute all commands in the given file (seperated by newlines), unless the line
  *      begins with a '#', in which case it will be treated as a comment. If the completion was successful,
- *      twoShell will print to the terminal a list of the executed commands.
+ *      twoShell will print to the terminal a list of the executed commands. Commands in the file still
+ *      read from the shell's stdin, not from the rest of the batch file.
+ *      ./twoShell -j 8 filename.txt runs up to 8 lines at once (the lines had better not depend on each
+ *      other). Each line's output is held back and printed in file order. Builtins like cd, and "wait"
+ *      on a line of its own, wait for everything before them and hold up everything after them.
  * built in command: history
  *      View all previously executed commands
+ *      History is saved to ~/.twoshell_history, so it carries over between (interactive) sessions.
+ *      Commands the shell waited on are listed with their exit status, run times and memory use.
+ *      TWOSHELL_HISTSIZE=n caps the history at the last n commands (older ones are dropped as new ones
+ *      come in), and TWOSHELL_HISTCONTROL=ignoredups skips a command that's the same as the one before it.
+ *      "history --top [n]" lists the n (10) commands that have taken the most time altogether, with how
+ *      many times each was run. With TWOSHELL_FRECENCY set, auto-complete suggests the command run most
+ *      often and most recently rather than just the most recent, and UP goes through each different
+ *      command once, in that order.
+ * built in commands: jobs, fg, bg
+ *      Commands run with & are background jobs. "jobs" lists them, "fg %n" brings one back to the
+ *      foreground and "bg %n" restarts a stopped one in the background. CTRL-Z stops the foreground job.
+ *      Finished background jobs are reported (and their run stats recorded) before the next prompt.
+ *      "top [-d seconds] [-n samples]" lists every process of every background job, pipeline stages
+ *      included, with its CPU use, memory, bytes read and written, and how long it's been running, again
+ *      every second until enter is pressed. The stage using a whole CPU is the one holding a pipeline up.
+ * built in commands: echo, pwd, true, false, test, [, printf
+ *      These work like the programs of the same names (redirections and pipes included), but the
+ *      shell runs them itself rather than starting a program for each one.
+ * built in command: hash
+ *      The shell remembers where on $PATH it found each command, so it only searches $PATH the first
+ *      time. "hash" lists what it remembers, "hash -r" forgets all of it (so does changing $PATH), and
+ *      "hash name" looks name up now.
+ * built in command: time
+ *      "time cmd | cmd2 ..." runs the rest of the line, then prints its real/user/sys time and max memory.
+ * Tracing: ./twoShell -t trace.jsonl (or TWOSHELL_TRACE=trace.jsonl) writes a line of JSON to trace.jsonl for
+ *      every line parsed, pipe made, file redirected, process started and process waited on or reaped,
+ *      with a nanosecond timestamp and the pid. See trace.h.
  * Users can key UP and DOWN to scroll through the previously executed commands (similar to zsh/Bash).
  * Users can press CTRL-C to enter "auto-complete mode." While in autocomplete mode, if the user begins to
  *      enter a command that is in the history, that command will automatically be supplied to the terminal prompt.
+ *      The most recent command starting with everything typed so far is the one supplied, and it keeps
+ *      narrowing down with every character typed. Deleting from a supplied command accepts what is left.
  *      Users can press CTRL-C again to toggle off the mode.
+ * Users can press CTRL-R to search the history. Typing narrows it down to the commands that have what was
+ *      typed in them, in order but not necessarily together ("gco" finds "git checkout"), best match
+ *      first: the tightest match, then the most recent and most often run. CTRL-R again offers the next
+ *      best match, enter runs it, any other key takes it onto the command line, and CTRL-G gives up.
  * 
  * Bonus!
  * While in auto-complete mode (or in the midst of UP/DOWN arrowing through history), users can edit their 
  * commands before executing. Surprisingly, I had to specially implement the ability to delete characters.
  *
  * Implementation Details:
- * Command history is stored in a homebrew link_list. Implementing "scrolling" with the up/down keys and
+ * Command history is stored in a homebrew ring buffer (behind the old link_list API), so looking up
+ * an entry by index is O(1) no matter how long the history gets. Implementing "scrolling" with the up/down keys and
  * autocomplete necessitates reading each character as it enters the terminal (before the user presses enter).
  * This was acheived using deep magic from Stack Overflow. This character by character input is managed by 
  * a homebrew String class, found in dstring.h. 
- * Input from stdin is read into a char**, which then necessitates frequent shuffling of char*'s to
- * appropriate variables. Better, I think, would be a linked-list type structure (which I've now made, but
- * switching over is going to have to wait until 3shell). That would allow me to more easily 
- * remove/re-arrange parts of the command as needed.
+ * Input from stdin is split into tokens in a single pass, written into an arena (arena.h), and the
+ * "command"s below are just pointers into those tokens -- no shuffling or copying of char*'s. Once the
+ * line has run, resetting the arena frees all of it at once. See parse.h.
+ * Batch files are memory mapped and read a line at a time straight out of the mapping (batch_file.h).
  * Each shell command is broken up into its base components, confusingly named "command". Here, I use
  * command to mean program name, program flags, and redirect information. For example, if
  * "cat file > out | grep "a" " is read from stdin, we would have two command structs, the first holding
  * "cat file > out", and the second holding "grep "a" ".
  * This design decision stems from a belief that this structure will more easily expanded to allow for
- * any number of programs to be piped together.
+ * any number of programs to be piped together. (It did!) The shell forks every program in a pipeline
+ * itself, with all the pipes created up front, and then waits on each one.
+ * Each pipeline is a job in the job table (jobs.h). Background jobs are reaped by a SIGCHLD handler as
+ * soon as they exit, and the shell only ever waits on the exact pids of the job in the foreground.
  * 
- *  Unexpected Behaviour:
- *  If the user enters auto-complete mode and has a command auto-filled, THEN deletes that entire command,
- *  auto-complete will act as if it is "off" until the user presses enter.
+ *  Auto-complete looks prefixes up in a trie over the history (trie.h), so each keystroke costs
+ *  O(length of what was typed) no matter how long the history is. The history loaded at startup is
+ *  put in the trie a chunk at a time while the prompt waits for keys, rather than before the prompt.
+ *  CTRL-R's search keeps an index of the history (search.h) so each key only looks at what matched
+ *  the key before, and rules most of it out without reading the entry.
+ *  echo, pwd, true, false, test/[ and printf are run by the shell itself (builtins.h): on their own, right
+ *  in the shell process, and as a stage of a pipeline (or in the background) in a fork()ed copy of the
+ *  shell that never has to exec anything.
+ *  Commands are run by their full path, looked up in a hash table of where each one was found on $PATH
+ *  (path_hash.h), rather than having posix_spawnp try every directory on $PATH every time.
+ *  Redrawing the command line (scrolling, suggestions, backspace) only sends the terminal the part of
+ *  the line that changed (screen.h), rather than clearing the line and printing it all again.
  *
  * Sources:
  * Terminal adjustment functions in helper.h
  * https://stackoverflow.com/questions/7469139/what-is-the-equivalent-to-getch-getche-in-linux
  * -niko
- * Delete the line where the terminal cursor currently is located
- * https://stackoverflow.com/questions/1508490/erase-the-current-printed-console-line
- * - mouviciel
  *
  * @file main.c
  * @author Dakotah Kurtz
@@ -58,107 +109,220 @@
  *
  */
 
+#define _GNU_SOURCE // pipe2, environ
+#include <errno.h>
 #include <fcntl.h> // file flags
 #include <stdio.h>
 #include <stdlib.h> // exit
 #include <string.h>
 #include <sys/types.h> // pid_t
 #include <sys/wait.h>  // wait
+#include <sys/resource.h> // rusage
+#include <time.h>      // clock_gettime
 #include <unistd.h>    // fork, execlp
 #include <signal.h> // SIGINT
+#include <spawn.h>  // posix_spawn
 
 #include "linked_list.h"
 #include "dstring.h"
+#include "edit_list.h"
+#include "history_file.h"
+#include "batch_file.h"
 #include "helper.h"
+#include "arena.h"
+#include "parse.h"
+#include "jobs.h"
+#include "screen.h"
+#include "path_hash.h"
+#include "builtins.h"
+#include "search.h"
+#include "frecency.h"
+#include "trace.h"
+#include "top.h"
 
 
-struct command
-{
-    char **exe;    // command and flags
-    char *in;      // input file name
-    char *out;     // output file name
-    pid_t pid;     // pid of process executing command
-    int exe_size;  // 1 + number of flags
-    int redir_in;  // flag to indicate <
-    int redir_out; // flag to indicate >
-    int append;    // flag to indicate >>
-};
+/*
+    Starts a single command, including all flags and redirect options, reading from in_fd and writing to
+    out_fd (-1 leaves the shell's own stdin/stdout). With job control on, the command is put in process
+    group pgid (0 starts a new group led by the command itself), and if foreground is set, that group is
+    given the terminal. pgid -1 leaves the process group alone. Returns the pid of the new process, -1 if
+    it couldn't be started.
+*/
+pid_t execute(struct command c, int in_fd, int out_fd, pid_t pgid, int foreground);
+
+/*
+    Starts every command in the given array as one pipeline, each command's output going to the next
+    one's input. The shell starts every stage itself (no stage starts another) and fills in each command's
+    pid, -1 for any that couldn't be started. With job control on, the whole pipeline shares one process
+    group. Returns the number of commands started.
+*/
+int execute_commands(struct command commands[], int command_count, int foreground);
+
+/*
+    Runs one of the utilities from builtins.h right in the shell, with the command's redirections
+    applied to the shell's own stdin/stdout until it's done. Returns its exit status.
+*/
+int run_builtin(builtin_fn fn, struct command c);
 
 /*
-    Set the standard stream to the given path, with given flags and permissions.
-    Returns 1 if redirection was successful, 0 otherwise.
+    Runs one of the utilities from builtins.h in a forked copy of the shell, set up the way execute()
+    sets up a program (same arguments). Returns the pid of the new process, -1 if it couldn't be started.
 */
-int redir(char *path, int stream, int flags, int permissions);
+pid_t fork_builtin(builtin_fn fn, struct command c, int in_fd, int out_fd, pid_t pgid, int foreground);
 
 /*
-    Returns a struct "loaded" with the given command, flags, and redirect options. Given one full
-    "command". For example, if the user enters "ls -l | grep a", the load function expects a pointer
-    to JUST ls -l.
+    Print stats to stderr the way bash's time does (plus memory use).
 */
-struct command load(char **arr, int size);
+void print_time(run_stats *stats);
 
-void free_command(struct command c);
+/*
+    Nanoseconds since the given CLOCK_MONOTONIC time.
+*/
+long long elapsed_ns(struct timespec *since);
 
 /*
-    Executes a single command, including all flags and redirect options.
+    A timeval (as found in struct rusage) in microseconds.
 */
-void execute(struct command c);
+long long timeval_us(struct timeval tv);
 
 /*
-    Sequentially executes the given array of commands, from curr_command to command_count.
+    Fills in stats for something the shell did itself since started, before being the shell's rusage then.
 */
-void execute_commands(struct command commands[], int curr_command, int command_count);
+void shell_stats(run_stats *stats, int status, struct timespec *started, struct rusage *before);
 
+/*
+    Returns 1 if the given command is one the shell runs itself (see shell_builtins below), 0 otherwise.
+*/
+int is_builtin(char *name);
 
 /*
     Signal handler to turn SIGINT (Ctrl-C) into auto-complete mode toggle
 */
 void sig_handler(int);
 
+/*
+    Does a chunk (CATCH_UP_CHUNK entries) of the indexing put off while the history loaded, so the first
+    prompt comes up straight away. The prompt calls it while the user isn't typing. Returns 1 while
+    there's more to do.
+*/
+int catch_up(llist *history, hsearch *search);
+
 #define prompt                                 \
     if (!batch_mode)                           \
     {                                          \
         printf("twoShell%s %% ", current_dir); \
     }
 
-static char *fork_err_msg = "forking error";
+// history entries catch_up indexes at a time, a fraction of a millisecond of work (a few, now and then,
+// for a history of a million different commands), which is as long as a key typed in the middle waits
+#define CATCH_UP_CHUNK 25
+
 static char *chdir_err_msg = "chdir error";
 static char *pipe_err_msg = "pipe error";
-static char *fopen_err_msg = "file open error";
+static char *pipe_size_err_msg = "can't make pipes that size";
+
+// commands handled "in house"
+static char *shell_builtins[] = {"exit", "history", "jobs", "fg", "bg", "wait", "cd", "hash", "top", NULL};
+
+// where each command was found on $PATH
+static phash path_hash;
+
+// what the pipes between the stages of a pipeline can hold, 0 leaves them at the kernel's 64K (-p)
+static int pipe_size = 0;
 
 int autcmplt_mode = 0;
 
 int main(int argc, char **argv)
 {
     signal(SIGINT, sig_handler);
+    // big enough that everything echoed for one batch of keys (even a big paste) goes out in one write()
+    setvbuf(stdout, NULL, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF, 65536);
 
-    // ANSI escape characters -- really hope this ports
-    const char esc = '\033';
-    const char up = 'A';
-    const char down = 'B';
+    // arrow keys etc. come out of next_key() already decoded (see helper.h)
     const char delete = 127;
+    const char ctrl_r = 18; // search the history
+    const char ctrl_g = 7;  // give up searching
+    keyreader keys;
+    init_keys(&keys);
+    // Ctrl-R's fuzzy history search, and what the command line shows while it's on
+    hsearch search;
+    init_search(&search);
+    dstring search_text;
+    init_string(&search_text);
+    // what the command line shows, so redrawing it only sends what changed
+    sline screen;
+    init_screen(&screen);
 
     char *line = NULL;
     char **args = NULL;
+    // everything parsed out of the current line lives here, and goes in one arena_reset()
+    arena line_arena;
+    init_arena(&line_arena);
     char current_dir[1024];
     dstring *input_string = malloc(sizeof(dstring)); // store new command user is in the process of entering
-    input_string->size = 0;
+    init_string(input_string);
+    // what the user actually typed on the new command line. Auto-complete may show more than this
+    // in input_string, but it only ever matches history against what was typed.
+    dstring *typed = malloc(sizeof(dstring));
+    init_string(typed);
 
     int batch_mode = 0;
+    char *batch_path = NULL;
+    int workers = 1; // how many batch lines may run at once (-j)
     int args_count = 0;
     int bg = 0;
-    int command_count = 0;
-    int found = 0;    
 
-    size_t len = 0;
     ssize_t nread;
+    bfile batch;
 
     getcwd(current_dir, sizeof(current_dir)); // get the current directory for display
 
-    if (argc == 2) // attempt to enter batch mode
+    int opt;
+    char *trace_path = getenv("TWOSHELL_TRACE");
+    if (getenv("TWOSHELL_PIPE_SIZE") != NULL)
+    {
+        pipe_size = atoi(getenv("TWOSHELL_PIPE_SIZE"));
+    }
+    while ((opt = getopt(argc, argv, "j:t:p:")) != -1)
+    {
+        if (opt == 't')
+        {
+            trace_path = optarg;
+        }
+        else if (opt == 'p')
+        {
+            // bigger pipes mean fewer trips between the stages of a pipeline moving a lot of data
+            pipe_size = atoi(optarg);
+        }
+        else if (opt != 'j' || (workers = atoi(optarg)) < 1)
+        {
+            fprintf(stderr, "usage: %s [-j workers] [-p pipe size] [-t trace file] [batch file]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (pipe_size > 0)
+    {
+        // unprivileged, a pipe can only be made as big as /proc/sys/fs/pipe-max-size (1M), find out now
+        // rather than on every pipeline
+        int test[2];
+        if (pipe(test) == -1 || fcntl(test[1], F_SETPIPE_SZ, pipe_size) == -1)
+        {
+            perror(pipe_size_err_msg);
+            return -1;
+        }
+        close(test[0]);
+        close(test[1]);
+    }
+    // what the shell does with each line, as it does it, goes to the trace file (see trace.h)
+    if (trace_path != NULL && *trace_path != '\0' && !open_trace(trace_path))
     {
-        // redirect input from stdin to come from the file
-        if (redir(argv[1], 0, O_RDONLY, 0666))
+        return -1;
+    }
+    if (optind == argc - 1) // attempt to enter batch mode
+    {
+        batch_path = argv[optind];
+        // lines come straight out of the file (see batch_file.h), stdin stays stdin
+        if (open_batch(&batch, batch_path))
         {
             batch_mode = 1;
         }
@@ -186,55 +350,152 @@ int main(int argc, char **argv)
         printf("by Dakotah\n\n");
     }
 
-    // linked_list to store the history
+    // ring buffer to store the history (see linked_list.h)
     llist *history_ll = malloc(sizeof(llist));
-    history_ll->length = 0;
-    history_ll->head = NULL;
-    history_ll->tail = NULL;
+    init_list(history_ll);
+    // TWOSHELL_HISTSIZE=n keeps only the last n commands, so a long running shell stops growing.
+    // TWOSHELL_HISTCONTROL=ignoredups doesn't record a command run twice in a row twice.
+    if (getenv("TWOSHELL_HISTSIZE") != NULL)
+    {
+        set_limit(history_ll, atoi(getenv("TWOSHELL_HISTSIZE")));
+    }
+    if (getenv("TWOSHELL_HISTCONTROL") != NULL && strstr(getenv("TWOSHELL_HISTCONTROL"), "ignoredups"))
+    {
+        set_dedup(history_ll, 1);
+    }
+    // copy-on-write edits of history entries the user has scrolled to
+    elist history_edits;
+    init_edits(&history_edits);
+
+    // persistent history, only kept for interactive sessions
+    hfile history_file;
+    history_file.fd = -1;
+    history_file.map = NULL;
+    if (!batch_mode && getenv("HOME") != NULL)
+    {
+        char history_path[1024];
+        snprintf(history_path, sizeof(history_path), "%s/%s", getenv("HOME"), HISTORY_FILE_NAME);
+        open_history(&history_file, history_path, history_ll);
+    }
+    // what each different command has cost, from here on (the history file doesn't say, its commands
+    // just count as having run once per entry). With
+    // TWOSHELL_FRECENCY set, auto-complete and the up arrow go by it (see frecency.h)
+    cstats command_stats;
+    init_command_stats(&command_stats);
+    track_commands(history_ll, &command_stats);
+    int prefer_frecent = getenv("TWOSHELL_FRECENCY") != NULL;
+
+    // process groups and handing the terminal over only make sense when there's a user at a terminal
+    init_jobs(!batch_mode && isatty(STDIN_FILENO));
+    init_path_hash(&path_hash);
 
     while (1)
     {
+        // finished background jobs get reaped by the SIGCHLD handler as they go, this just tells the user
+        report_jobs(history_ll, !batch_mode);
         fflush(stdout);
+        flush_trace();
         if (batch_mode)
         {
-            do
-            { // in Batch mode, all input comes directly from the file (stdin)
-                if (((nread = getline(&line, &len, stdin)) == EOF))
+            // in Batch mode, all input comes directly from the file
+            if ((line = next_batch_line(&batch)) == NULL)
+            {
+                if (workers > 1)
                 {
-                    printf("%s batch completed: \n", argv[1]);
-                    print(history_ll, '\n');
-                    return 0;
+                    // every line's output has to be printed before we're done
+                    wait_for_jobs(0);
+                    report_jobs(history_ll, 0);
                 }
-
-            } while (!strcmp(line, "") || (starts_with(line, '#')));
+                printf("%s batch completed: \n", batch_path);
+                print(history_ll, '\n');
+                close_batch(&batch);
+                return 0;
+            }
         }
         else
         {
-            char c;
+            int c;
             int count = (history_ll->length); // how many commands are in history
-            dstring *history_additions[count];
-            // allocate dstrings for all history commands to allow users to edit them
-            for (int i = 0; i < count; i++)
-            {
-                dstring *string = malloc(sizeof(dstring));
-                history_additions[i] = string;
-                history_additions[i]->size = 0;
-                char *hist = get(history_ll, i);
-                int j = 0;
-                // copy the value in history linkedlist to the appropriate history dstring
-                while (hist[j] != '\0')
-                {
-                    add_end(history_additions[i], hist[j]);
-                    j++;
-                }
-            }
+            int searching = 0; // Ctrl-R was pressed, keys go to the search until it's over
+            int *frecent = NULL; // with prefer_frecent, the order the up arrow goes through the history in
+            int frecent_count = 0;
+            int frecent_at = -1; // where in frecent the entry being shown is, -1 for the command line
+            int behind = 1; // catch_up has more to do
+            // history entries are only copied (into history_edits) once the user actually edits one
+            initTermios(0); // no echo, no line buffering, for the whole prompt rather than per key
             do // actually get the command
             {
-                prompt while (1) // until the user enters a command and presses enter
+                prompt reset_screen(&screen);
+                while (1) // until the user enters a command and presses enter
                 {
-                    c = getch();
+                    // whatever indexing is left over from loading the history gets done while the user
+                    // isn't typing
+                    while (behind && !key_waiting(&keys))
+                    {
+                        behind = catch_up(history_ll, &search);
+                    }
+                    c = next_key(&keys);
+
+                    if (c == ctrl_r || searching)
+                    {
+                        if (!searching)
+                        {
+                            searching = 1;
+                            start_search(&search, history_ll);
+                        }
+                        else if (c == ctrl_r)
+                        {
+                            search_next(&search);
+                        }
+                        else if (c == delete)
+                        {
+                            search_delete(&search);
+                        }
+                        else if (c >= ' ' && c <= 255)
+                        {
+                            search_add(&search, c);
+                        }
+                        else
+                        {
+                            // anything else ends the search. The match (if there is one) goes onto the
+                            // command line, and the key does whatever it normally does with it there.
+                            // Ctrl-G throws the match away, escape just ends the search.
+                            int match = search_match(&search);
+                            if (match != -1 && c != ctrl_g)
+                            {
+                                count = history_ll->length;
+                                frecent_at = -1;
+                                copy_string(input_string, get(history_ll, match));
+                                copy_string(typed, as_cstring(input_string));
+                            }
+                            searching = 0;
+                            end_search(&search);
+                            show(&screen, count == history_ll->length ? as_cstring(input_string)
+                                                                      : view_entry(&history_edits, history_ll, count));
+                        }
+                        if (searching)
+                        {
+                            search_line(&search, &search_text);
+                            show(&screen, as_cstring(&search_text));
+                            continue;
+                        }
+                        if (c == ctrl_g || c == KEY_ESCAPE)
+                        {
+                            continue;
+                        }
+                    }
 
-                    if (c == delete)
+                    if (c == KEY_EOF)
+                    {
+                        // nobody left to type anything, treat it like the user typed exit
+                        count = history_ll->length;
+                        copy_string(input_string, "exit\n");
+                        printf("exit\n");
+                        line = as_cstring(input_string);
+                        nread = input_string->size;
+                        break;
+                    }
+                    else if (c == delete)
                     {
                         if (count == history_ll->length) // the user is entering a new command
                         {
@@ -242,49 +503,70 @@ int main(int argc, char **argv)
                             {
                                 // remove it from the input string, and adjust terminal to show that.
                                 remove_dstring_index(input_string, (input_string->size) - 1);
-                                putchar(0x8);
-                                putc(' ', stdout);
-                                putchar(0x8);
+                                show(&screen, as_cstring(input_string));
+                                // deleting from an auto-completed command accepts it, whatever is left on
+                                // the line is the user's own text from now on
+                                if (typed->size == input_string->size + 1)
+                                {
+                                    remove_dstring_index(typed, (typed->size) - 1);
+                                }
+                                else
+                                {
+                                    copy_string(typed, as_cstring(input_string));
+                                }
                             }
                         }
                         else // the user is deleting something they scrolled to using arrow keys
                         { 
-                            if (history_additions[count]->size > 0)
+                            dstring *edit = edit_entry(&history_edits, history_ll, count);
+                            if (edit->size > 0)
                             {
-                                // remove from history dstring, and adjust terminal to show that
-                                remove_dstring_index(history_additions[count], (history_additions[count]->size) - 1);
-                                putchar(0x8);
-                                putc(' ', stdout);
-                                putchar(0x8);
+                                // remove from the edited copy, and adjust terminal to show that
+                                remove_dstring_index(edit, (edit->size) - 1);
+                                show(&screen, as_cstring(edit));
                             }
                         }
                     }
-                    else if (c == esc) // it's an escape char (arrow keys)
+                    else if (c > 255) // it's an escape sequence (arrow keys)
                     {
-                        getch(); // skip 'garbage'
-
-                        switch (getch())
+                        switch (c)
                         {
-                        case up:
-                            if (count != 0) // nothing in history below index 0
+                        case KEY_UP:
+                            if (prefer_frecent)
+                            {
+                                // one of each different command, the most frecent first, rather than
+                                // the history as it happened
+                                if (frecent == NULL)
+                                {
+                                    track_entries(history_ll, history_ll->length); // whatever catch_up hasn't got to
+                                    frecent_count = frecent_order(&command_stats, history_ll, &frecent);
+                                }
+                                if (frecent_at + 1 < frecent_count)
+                                {
+                                    count = frecent[++frecent_at];
+                                    show(&screen, view_entry(&history_edits, history_ll, count));
+                                }
+                            }
+                            else if (count != 0) // nothing in history below index 0
                             {
                                 count--;
-                                /*
-                                  - mouviciel
-                                  */
-                                printf("\33[2K\r"); // Clear entire line, move cursor back to start of line
-                                prompt
-
-                                printf("%s", history_additions[count]->arr);
+                                // only what differs from what's on screen gets redrawn (see screen.h)
+                                show(&screen, view_entry(&history_edits, history_ll, count));
                             }
 
                             break;
 
-                        case down:
+                        case KEY_DOWN:
 
-                            printf("\33[2K\r"); // Clear entire line, move cursor back to start of line
-                            prompt 
-                            if (count < ((history_ll->length))) 
+                            if (prefer_frecent)
+                            {
+                                if (frecent_at != -1)
+                                {
+                                    frecent_at--;
+                                    count = frecent_at != -1 ? frecent[frecent_at] : history_ll->length;
+                                }
+                            }
+                            else if (count < ((history_ll->length))) 
                             // nothing in history beyond the linked_lists length
                             {
                                 count++;
@@ -293,15 +575,12 @@ int main(int argc, char **argv)
                             if (count < ((history_ll->length)))
                             {
 
-                                printf("%s", history_additions[count]->arr);
+                                show(&screen, view_entry(&history_edits, history_ll, count));
                             }
                             else // we've reached the end of the history - display any typing the user has done
                             // on a fresh line
                             {
-                                if (input_string->size > 0)
-                                {
-                                    printf("%s", input_string->arr);
-                                }
+                                show(&screen, as_cstring(input_string));
                             }
 
                             break;
@@ -309,71 +588,82 @@ int main(int argc, char **argv)
                     }
                     else // it's not an escape key, add it to the appropriate dstring
                     {
-                        if (count != history_ll->length) // editing history dstring
+                        if (count != history_ll->length) // editing history entry
                         {
-                            // only add new line if there is SOMETHING to execute
-                            if (!(c == '\n' && history_additions[count]->size == 0))
+                            // enter isn't an edit, it's picked up below
+                            if (c != '\n')
                             {
-                                add_end(history_additions[count], c);
+                                dstring *edit = edit_entry(&history_edits, history_ll, count);
+                                add_end(edit, c);
+                                show(&screen, as_cstring(edit));
                             }
                         }
-                        else if (!(c == '\n' && input_string->size == 0))
+                        else if (c == '\n')
                         {
-                            add_end(input_string, c);
+                            if (input_string->size != 0)
+                            {
+                                add_end(input_string, c);
+                            }
                         }
-                        putc(c, stdout);
-                    }
-                    // only auto-complete if we're not scrolling history and we haven't already
-                    // autofilled.
-                    if (autcmplt_mode && input_string->size != 0 && count == history_ll->length && !found)
-                    {
-                        int loc;
-                        if ((loc = contains(history_ll, input_string->arr)) != -1)
+                        else
                         {
-                            found = 1;
-                            printf("\33[2K\r"); // Clear entire line, move cursor back to start of line
-                            prompt
-                            line = get(history_ll, loc); // get matched command from history linkedlist
-                            printf("%s", line);
-                            int j = 0;
-                            // clear the input string and copy the auto-completed command into it
-                            if (input_string->size != 0)
+                            add_end(typed, c);
+                            char *suggestion = NULL;
+                            // only auto-complete if we're not scrolling history. Every keystroke looks
+                            // again, so the suggestion keeps narrowing down as the user types.
+                            if (autcmplt_mode && prefer_frecent)
                             {
-                                clear_string(input_string);
+                                track_entries(history_ll, history_ll->length); // whatever catch_up hasn't got to
+                                suggestion = frecent_prefix(&command_stats, as_cstring(typed));
                             }
-                            while (1)
+                            else if (autcmplt_mode)
                             {
-                                if (line[j] == '\0')
-                                {
-                                    break;
-                                }
-                                add_end(input_string, line[j]);
-
-                                j++;
+                                int loc = contains(history_ll, as_cstring(typed));
+                                suggestion = loc != -1 ? get(history_ll, loc) : NULL;
                             }
+                            if (suggestion != NULL || input_string->size != typed->size - 1)
+                            {
+                                // show the most recent (or most frecent) command starting with what was
+                                // typed, or drop a suggestion that no longer matches
+                                copy_string(input_string, suggestion != NULL ? suggestion : as_cstring(typed));
+                                show(&screen, as_cstring(input_string));
+                                continue;
+                            }
+                            add_end(input_string, c);
+                            show(&screen, as_cstring(input_string));
+                        }
+                        if (c == '\n')
+                        {
+                            putc(c, stdout);
                         }
                     }
 
                     if (c == '\n')
                     {
-                        found = 0; // reset autocomplete
-                        if (count != history_ll->length)
-                        { // going to run cmd from history, copy history dstring into input_string
-                            if (input_string->size > 1)
+                        char *selected;
+                        if (count != history_ll->length &&
+                            *(selected = view_entry(&history_edits, history_ll, count)) == '\0')
+                        {
+                            // scrolled to an entry and deleted all of it, nothing to run
+                            count = history_ll->length;
+                            frecent_at = -1;
+                            if (input_string->size > 0)
                             {
                                 clear_string(input_string);
+                                clear_string(typed);
                             }
-                            for (int i = 0; i < history_additions[count]->size; i++)
-                            {
-                                add_end(input_string, history_additions[count]->arr[i]);
-                            }
+                        }
+                        else if (count != history_ll->length)
+                        { // going to run cmd from history, copy (possibly edited) entry into input_string
+                            copy_string(input_string, selected);
+                            add_end(input_string, '\n');
 
-                            line = input_string->arr;
+                            line = as_cstring(input_string);
                             nread = input_string->size;
                         }
                         else if (input_string->size != 0)
                         {
-                            line = input_string->arr;
+                            line = as_cstring(input_string);
                             nread = input_string->size;
 
                         }
@@ -382,49 +672,108 @@ int main(int argc, char **argv)
                 }
                 // while the line the user hit enter on contains something other than the prompt
             } while (count == history_ll->length && input_string->size < 1);
+            resetTermios(); // the command gets the terminal the way it's used to
+            free(frecent);
+            fflush(stdout); // the newline the user typed goes out before anything the command says
 
-            for (int i = 0; i < (history_ll->length) - 1; i++)
-            {
-                free(history_additions[i]->arr);
-            }
+            reset_edits(&history_edits);
         }
 
-        nread--;
-
-        // in some branches, we end up with a new line on the end of the command
-        if (line[nread] == '\n')
+        // add to history
+        if (batch_mode)
         {
-            line[nread] = '\0';
+            // batch lines are already terminated and stay put until the batch file is closed, so the
+            // history can just point at them
+            add_last_ref(history_ll, line);
         }
+        else
+        {
+            nread--;
 
-        // add to history
-        add_last(history_ll, clean_string(line, nread));
-
-        args = malloc((nread) * sizeof(char *));
-        char *arg = strtok(line, " ");
+            // in some branches, we end up with a new line on the end of the command
+            if (line[nread] == '\n')
+            {
+                line[nread] = '\0';
+            }
 
-        while (arg != NULL)
-        { // load up args, splitting at spaces
-            args[args_count] = malloc(strlen(arg) + 1);
-            // track the number of pipes
-            if (!strcmp(arg, "|"))
+            if (add_last(history_ll, clean_string(line, nread)))
             {
-                command_count++;
+                append_history(&history_file, get(history_ll, (history_ll->length) - 1));
             }
-            strcpy(args[args_count], arg);
-            args_count++;
-            arg = strtok(NULL, " ");
+            // just the new entry (and any it pushed out), unless catch_up is still building it
+            index_history(&search, history_ll, CATCH_UP_CHUNK);
+        }
+
+        trace_event(TRACE_PARSE_START, 0, 0, 0, line);
+        args_count = tokenize(&line_arena, line, &args);
+        trace_event(TRACE_PARSE_END, 0, args_count, 0, NULL);
+
+        // "time" in front of anything reports what running the rest of the line cost
+        int timed = 0;
+        if (args_count > 0 && !strcmp(args[0], "time"))
+        {
+            timed = 1;
+            args++;
+            args_count--;
+        }
+        run_stats stats;
+        stats.recorded = 0;
+        struct timespec started;
+        struct rusage self_before;
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        if (timed)
+        {
+            getrusage(RUSAGE_SELF, &self_before);
         }
 
-        command_count++; // command_count = #pipes + 1
+        if (workers > 1 && args_count > 0 && (timed || is_builtin(args[0])))
+        {
+            // builtins (cd especially) change or look at the shell itself, so in a parallel batch they
+            // wait for every line before them to finish (and print), and nothing after them starts
+            // until they're done. "wait" on a line of its own does just that.
+            wait_for_jobs(0);
+            report_jobs(history_ll, 0);
+        }
 
-        if (!strcmp(args[0], "exit"))
+        if (args_count == 0)
+        {
+            // nothing but spaces, nothing to do
+        }
+        else if (!strcmp(args[0], "exit"))
         {
             break;
         }
         else if (!strcmp(args[0], "history"))
         {
-            print(history_ll, '\n');
+            if (args[1] != NULL && !strcmp(args[1], "--top"))
+            {
+                track_entries(history_ll, history_ll->length); // whatever catch_up hasn't got to
+                print_top(&command_stats, args[2] != NULL ? atoi(args[2]) : 10);
+            }
+            else
+            {
+                print_stats(history_ll);
+            }
+        }
+        else if (!strcmp(args[0], "jobs"))
+        {
+            list_jobs();
+        }
+        else if (!strcmp(args[0], "top"))
+        {
+            top(args);
+        }
+        else if (!strcmp(args[0], "fg"))
+        {
+            fg_job(args[1], history_ll, &stats);
+        }
+        else if (!strcmp(args[0], "bg"))
+        {
+            bg_job(args[1]);
+        }
+        else if (!strcmp(args[0], "wait"))
+        {
+            wait_for_jobs(0);
         }
         else if (!strcmp(args[0], "cd"))
         {
@@ -437,6 +786,27 @@ int main(int argc, char **argv)
                 perror(chdir_err_msg);
             }
         }
+        else if (!strcmp(args[0], "hash"))
+        {
+            if (args[1] == NULL)
+            {
+                print_path_hash(&path_hash);
+            }
+            else if (!strcmp(args[1], "-r"))
+            {
+                clear_path_hash(&path_hash);
+            }
+            else
+            {
+                for (int i = 1; args[i] != NULL; i++)
+                {
+                    if (find_command(&path_hash, args[i]) == NULL)
+                    {
+                        fprintf(stderr, "hash: %s: not found\n", args[i]);
+                    }
+                }
+            }
+        }
         else
         { // "simple" command ie not built in
 
@@ -445,84 +815,120 @@ int main(int argc, char **argv)
             {
                 bg = 1;
                 args_count--;
-                char **temp;
-                // like the next three lines...this is messy. I THINK that a linked list would make
-                // this as simple as remove(&args, args_count);
-                copy_arr(args, &temp, 0, args_count);
-                free_arr(&args, args_count);
-                copy_arr(temp, &args, 0, args_count);
+                args[args_count] = NULL;
             }
 
             // "load" up the command structs, which are the contents of args seperated by pipes.
-            // This could be done when parsing stdin, but then I would need to dynamically allocate
-            // the struct. Maybe in version 1.1
-            struct command commands[command_count];
-            int i = 0;
-            int j = 0;
-            int curr_com_count = 0;
-            char **temp;
-            for (; i < args_count; i++)
-            {
-                if (!strcmp(args[i], "|"))
-                {
-                    copy_arr(args, &temp, j, i);
-                    commands[curr_com_count] = load(temp, (i - j));
-                    free_arr(&temp, (i - j));
-                    curr_com_count++;
-                    // kind of like a sliding window, and always skipping the pipe char itself
-                    j = i;
-                    j++;
-                }
-            }
+            // They point straight into args, so there's nothing to copy (or free) per command.
+            struct command *commands;
+            int command_count = load_pipeline(&line_arena, args, args_count, &commands);
 
-            // load the last command (always one more command than pipe)
-            copy_arr(args, &temp, j, i);
-            commands[curr_com_count] = load(temp, (i - j));
-            free_arr(&temp, (i - j));
-
-            pid_t pid = fork();
-            if (pid < 0)
+            builtin_fn utility = NULL;
+            if (command_count == 1 && commands[0].exe[0] != NULL)
             {
-                perror(fork_err_msg);
-                exit(-1);
+                utility = find_builtin(commands[0].exe[0]);
             }
-
-            else if (pid == 0)
+            if (utility != NULL && !bg && workers <= 1)
             {
-
-                execute_commands(commands, 0, command_count);
+                // echo, pwd and the like on their own run right here, no process needed (builtins.h).
+                // In a pipeline, in the background or in a parallel batch they get a process (but no
+                // exec), see execute().
+                struct rusage before;
+                getrusage(RUSAGE_SELF, &before);
+                int status = run_builtin(utility, commands[0]);
+                shell_stats(&stats, status, &started, &before);
+                trace_event(TRACE_BUILTIN, getpid(), status, stats.wall_ns, commands[0].exe[0]);
+                set_stats(history_ll, (history_ll->length) - 1, &stats);
             }
             else
             {
+                int buffered = 0;
+                if (workers > 1)
+                {
+                    // every line of a parallel batch runs in the background, once there's a worker free.
+                    // Its output is kept back until the lines before it have printed theirs.
+                    bg = 1;
+                    wait_for_jobs(workers - 1);
+                }
+
+                // the job has to be in the table before the SIGCHLD handler can hear about any of it
+                block_sigchld();
+                if (workers > 1)
+                {
+                    buffered = capture_output();
+                }
+                execute_commands(commands, command_count, !bg);
+                int id = add_job(commands, command_count, get(history_ll, (history_ll->length) - 1), !bg,
+                                 entry_seq(history_ll, (history_ll->length) - 1), &started);
+                if (buffered)
+                {
+                    attach_output(id);
+                }
                 if (bg == 0)
-                { // no ampersand parsed, shell should block
-                    wait(0);
+                { // no ampersand parsed, shell should block until the whole pipeline is done (or stopped)
+                    wait_job(id, history_ll, &stats); // unblocks SIGCHLD
+                }
+                else
+                {
+                    unblock_sigchld();
+                    if (!batch_mode)
+                    {
+                        printf("[%d] %d\n", id, commands[command_count - 1].pid);
+                    }
                 }
             }
+        }
 
-            for (int i = 0; i < command_count; i++)
+        if (timed)
+        {
+            if (!stats.recorded)
             {
-                free_command(commands[i]);
+                // a builtin (or just starting a background command), so it's the shell's own time
+                shell_stats(&stats, 0, &started, &self_before);
             }
-            curr_com_count = 0;
+            print_time(&stats);
         }
 
         args_count = 0;
         nread = 0;
         // len = 0;
-        command_count = 0;
         bg = 0;
         clear_string(input_string);
+        clear_string(typed);
 
-        free_arr(&args, args_count);
+        arena_reset(&line_arena); // args, commands and every token, all at once
     }
 
-    free(line);
+    close_history(&history_file);
+    if (batch_mode)
+    {
+        close_batch(&batch); // lines belong to the batch file, interactive lines belong to input_string
+    }
     exit(EXIT_SUCCESS);
 
     return 0;
 }
 
+int is_builtin(char *name)
+{
+    for (int i = 0; shell_builtins[i] != NULL; i++)
+    {
+        if (!strcmp(name, shell_builtins[i]))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int catch_up(llist *history, hsearch *search)
+{
+    // Ctrl-R has to wait for its index if it isn't done, and so does anything that goes by the command
+    // stats. Auto-complete can get by without the trie
+    return index_history(search, history, CATCH_UP_CHUNK) || track_entries(history, CATCH_UP_CHUNK) ||
+           index_entries(history, CATCH_UP_CHUNK);
+}
+
 void sig_handler(int signo)
 {
     if (signo == SIGINT)
@@ -532,184 +938,350 @@ void sig_handler(int signo)
     }
 }
 
-void execute_commands(struct command commands[], int curr_command, int command_count)
+void print_time(run_stats *stats)
 {
+    fflush(stdout); // anything a builtin printed belongs before the times
+    fprintf(stderr, "\nreal\t%lldm%.3fs\nuser\t%lldm%.3fs\nsys\t%lldm%.3fs\nmaxrss\t%ldKB\n",
+            stats->wall_ns / 60000000000LL, (stats->wall_ns % 60000000000LL) / 1e9,
+            stats->user_us / 60000000LL, (stats->user_us % 60000000LL) / 1e6,
+            stats->sys_us / 60000000LL, (stats->sys_us % 60000000LL) / 1e6,
+            stats->max_rss_kb);
+}
 
-    // only one command left, don't need fork()
-    if ((curr_command + 1) == command_count)
-    {
-        execute(commands[curr_command]);
-    }
-    else
+long long elapsed_ns(struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000000000LL + (now.tv_nsec - since->tv_nsec);
+}
+
+long long timeval_us(struct timeval tv)
+{
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+void shell_stats(run_stats *stats, int status, struct timespec *started, struct rusage *before)
+{
+    struct rusage after;
+    getrusage(RUSAGE_SELF, &after);
+    stats->recorded = 1;
+    stats->status = status;
+    stats->wall_ns = elapsed_ns(started);
+    stats->user_us = timeval_us(after.ru_utime) - timeval_us(before->ru_utime);
+    stats->sys_us = timeval_us(after.ru_stime) - timeval_us(before->ru_stime);
+    stats->max_rss_kb = after.ru_maxrss;
+}
+
+int execute_commands(struct command commands[], int command_count, int foreground)
+{
+    // every pipe is created up front, pipes[i] connects command i to command i + 1. They're all
+    // close-on-exec, so each stage only keeps the two ends it dup2()s onto stdin/stdout.
+    int pipes[command_count][2];
+    for (int i = 0; i < command_count - 1; i++)
     {
-        if (commands[curr_command].redir_out != 0)
+        if (pipe2(pipes[i], O_CLOEXEC) == -1)
         {
-            // will need to run command twice, once for redirect and once for pipe
-            pid_t pid = fork();
-            if (pid < 0)
-            {
-                perror(fork_err_msg);
-            }
-            else if (pid == 0)
+            perror(pipe_err_msg);
+            for (int j = 0; j < i; j++)
             {
-                execute(commands[curr_command]);
+                close(pipes[j][0]);
+                close(pipes[j][1]);
             }
-            // remove redirect out information
-            commands[curr_command].redir_out = 0;
-            free(commands[curr_command].out);
-        } // pipe to next command
-
-        int pipe_fd[2];
-        if (pipe(pipe_fd) == -1)
-        {
-            perror(pipe_err_msg);
-            exit(1);
+            return 0;
         }
-
-        pid_t pid = fork();
-        if (pid < 0)
+        trace_event(TRACE_PIPE, getpid(), pipes[i][0], pipes[i][1], NULL);
+        if (pipe_size > 0)
         {
-            perror(fork_err_msg);
+            fcntl(pipes[i][1], F_SETPIPE_SZ, pipe_size); // already known to work
         }
-        else if (pid == 0)
-        {
-            close(STDOUT_FILENO); // closing stdout
-            dup(pipe_fd[1]);      // replacing stdout with pipe write
-            close(pipe_fd[0]);    // closing pipe read
-            close(pipe_fd[1]);
+    }
 
-            execute(commands[curr_command]);
+    int started = 0;
+    pid_t pgid = job_control_on() ? 0 : -1; // the first stage to start leads the pipeline's group
+    for (int i = 0; i < command_count; i++)
+    {
+        // read from the previous command, write to the next one. A stage that fails to start just
+        // means its neighbours see EOF/EPIPE, same as if it had exited straight away.
+        commands[i].pid = execute(commands[i], i > 0 ? pipes[i - 1][0] : -1,
+                                  i < command_count - 1 ? pipes[i][1] : -1, pgid, foreground);
+        if (commands[i].pid != -1)
+        {
+            started++;
+            if (pgid == 0)
+            {
+                pgid = commands[i].pid;
+            }
         }
+    }
 
-        close(STDIN_FILENO); // closing stdin
-        dup(pipe_fd[0]);     // replacing stdin with pipe read
-        close(pipe_fd[1]);   // closing pipe write
-        close(pipe_fd[0]);
-
-        execute(commands[++curr_command]);
+    // the shell doesn't use any of the pipes itself. Closing our copies is what lets each reader see EOF.
+    for (int i = 0; i < command_count - 1; i++)
+    {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
     }
+    return started;
 }
 
-void execute(struct command c)
+pid_t execute(struct command c, int in_fd, int out_fd, pid_t pgid, int foreground)
 {
-    c.pid = getpid(); // tracking pid for future features
+    // "< file" at the start of a pipeline or "> file" at the end, with no command. The shell moves
+    // the data between the file and the pipe itself (see copy_stage in builtins.h)
+    char *copy_argv[2] = {c.in, NULL};
+    if (c.exe[0] == NULL && c.redir_in && !c.redir_out && c.in != NULL && in_fd == -1 && out_fd != -1)
+    {
+        c.exe = copy_argv;
+        return fork_builtin(copy_stage, c, in_fd, out_fd, pgid, foreground);
+    }
+    if (c.exe[0] == NULL && c.redir_out && !c.redir_in && c.out != NULL && in_fd != -1 && out_fd == -1)
+    {
+        copy_argv[0] = c.out;
+        c.exe = copy_argv;
+        return fork_builtin(copy_stage, c, in_fd, out_fd, pgid, foreground);
+    }
+    if (c.exe[0] == NULL)
+    {
+        fprintf(stderr, "missing command\n");
+        return -1;
+    }
+    if ((c.redir_in && c.in == NULL) || (c.redir_out && c.out == NULL))
+    {
+        fprintf(stderr, "command %s failed: missing file name to redirect to\n", c.exe[0]);
+        return -1;
+    }
+    builtin_fn utility = find_builtin(c.exe[0]);
+    if (utility != NULL)
+    {
+        return fork_builtin(utility, c, in_fd, out_fd, pgid, foreground);
+    }
 
+    // posix_spawn does the dup2()s and open()s for us in the new process, without copying the shell's
+    // page tables the way fork() would. Order matters: a redirect lands on top of a pipe, so it wins.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (in_fd != -1)
+    {
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    }
+    if (out_fd != -1)
+    {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
     if (c.redir_in)
     {
-        redir(c.in, 0, O_RDONLY, 0666);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, c.in, O_RDONLY, 0666);
     }
     if (c.redir_out)
     {
         if (c.append == 0)
         {
-            redir(c.out, 1, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+            posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, c.out, O_CREAT | O_WRONLY | O_TRUNC, 0666);
         }
         else
         {
             // don't truncate, append
-            redir(c.out, 1, O_CREAT | O_WRONLY | O_APPEND, 0666);
+            posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, c.out, O_CREAT | O_WRONLY | O_APPEND, 0666);
         }
     }
 
-    if ((execvp(c.exe[0], c.exe)) == -1)
+    // the shell blocks SIGCHLD while it starts a job and ignores the job control signals, neither of
+    // which the command should inherit
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTSTP);
+    sigaddset(&signals, SIGTTIN);
+    sigaddset(&signals, SIGTTOU);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    if (pgid != -1)
     {
-        fprintf(stderr, "command %s failed\n", c.exe[0]);
-        exit(-1); // important to exit, otherwise child gets lost
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, pgid);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+        // the group leader takes the terminal before it runs, otherwise it could try to read from it
+        // before the shell gets round to handing it over (wait_job does that too, for older glibc)
+        if (foreground && pgid == 0)
+        {
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+        }
+#endif
     }
-}
+    posix_spawnattr_setflags(&attr, flags);
 
-void free_command(struct command c)
-{
-    free_arr(&(c.exe), c.exe_size);
-    if (c.redir_in != 0)
+    pid_t pid;
+    int err = ENOENT;
+    long long spawn_started = trace_clock();
+    char *path = find_command(&path_hash, c.exe[0]);
+    if (path != NULL)
     {
-        free((c.in));
+        err = posix_spawn(&pid, path, &actions, &attr, c.exe, environ);
+        // ENOENT is also what a missing < file gives. Only if the program itself is gone (moved or
+        // deleted since it was hashed) is it worth looking for again
+        if (err == ENOENT && path != c.exe[0] && access(path, X_OK) == -1)
+        {
+            forget_command(&path_hash, c.exe[0]);
+            path = find_command(&path_hash, c.exe[0]);
+            if (path != NULL)
+            {
+                err = posix_spawn(&pid, path, &actions, &attr, c.exe, environ);
+            }
+        }
     }
-    if (c.redir_out != 0)
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0)
     {
-        free(c.out);
+        // covers the command not existing as well as a redirect file that couldn't be opened
+        fprintf(stderr, "command %s failed: %s\n", c.exe[0], strerror(err));
+        return -1;
     }
+    if (tracing())
+    {
+        trace_event(TRACE_SPAWN, pid, trace_clock() - spawn_started, 0, c.exe[0]);
+        // the new process opened these itself, before it exec()ed
+        if (c.redir_in)
+        {
+            trace_event(TRACE_REDIRECT, pid, STDIN_FILENO, 0, c.in);
+        }
+        if (c.redir_out)
+        {
+            trace_event(TRACE_REDIRECT, pid, STDOUT_FILENO, 0, c.out);
+        }
+    }
+    return pid;
 }
-int redir(char *path, int to_close, int flags, int permissions)
+
+int run_builtin(builtin_fn fn, struct command c)
 {
-    int stream = open(path, flags, permissions);
-    if (stream == -1)
+    if ((c.redir_in && c.in == NULL) || (c.redir_out && c.out == NULL))
     {
-        perror(fopen_err_msg);
+        fprintf(stderr, "command %s failed: missing file name to redirect to\n", c.exe[0]);
+        return 1;
     }
-    close(to_close);
-    int result = dup(stream);
-    if (result == -1)
+    // none of the utilities read stdin, so < just has to name a file that can be opened
+    if (c.redir_in)
     {
-        perror(fopen_err_msg);
+        int in = open(c.in, O_RDONLY | O_CLOEXEC);
+        if (in == -1)
+        {
+            fprintf(stderr, "command %s failed: %s\n", c.exe[0], strerror(errno));
+            return 1;
+        }
+        trace_event(TRACE_REDIRECT, getpid(), STDIN_FILENO, 0, c.in);
+        close(in);
     }
-    close(stream);
-    if (result == -1)
+
+    int saved_out = -1;
+    if (c.redir_out)
     {
-        return 0;
+        int out = open(c.out, O_CREAT | O_WRONLY | O_CLOEXEC | (c.append ? O_APPEND : O_TRUNC), 0666);
+        if (out == -1)
+        {
+            fprintf(stderr, "command %s failed: %s\n", c.exe[0], strerror(errno));
+            return 1;
+        }
+        trace_event(TRACE_REDIRECT, getpid(), STDOUT_FILENO, 0, c.out);
+        fflush(stdout); // what the shell printed before this still goes to the real stdout
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+        dup2(out, STDOUT_FILENO);
+        close(out);
     }
-    else
+
+    int status = fn(c.exe);
+
+    if (saved_out != -1)
     {
-        return 1;
+        fflush(stdout);
+        dup2(saved_out, STDOUT_FILENO);
+        close(saved_out);
     }
+    return status;
 }
 
-struct command load(char **arr, int size)
+pid_t fork_builtin(builtin_fn fn, struct command c, int in_fd, int out_fd, pid_t pgid, int foreground)
 {
-    int exel = size; // to track command+flag length
-    int inl = 0;     // index of in file
-    int outl = 0;    // index of out file
-
-    struct command temp;
-    temp.redir_in = 0;
-    temp.redir_out = 0;
-    temp.append = 0;
-
-    for (int i = 0; i < size; i++)
+    // the child gets a copy of the shell's stdio buffers, anything still in them would be printed twice
+    fflush(stdout);
+    fflush(stderr);
+    long long fork_started = trace_clock();
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        fprintf(stderr, "command %s failed: %s\n", c.exe[0], strerror(errno));
+        return -1;
+    }
+    if (pid > 0)
     {
-        if (!strcmp(arr[i], "<"))
+        // the child sets its group too. Doing it on both sides means it's done before either of us
+        // moves on, so the next stage of the pipeline can join the group
+        if (pgid != -1)
         {
-            exel = i;
-            inl = i + 1;
-            temp.redir_in = 1;
+            setpgid(pid, pgid == 0 ? pid : pgid);
         }
-        else if (!strcmp(arr[i], ">"))
-        {
-            outl = i + 1;
-            temp.redir_out = i + 1;
+        // the child's redirects aren't traced, it has its own copy of the ring
+        trace_event(TRACE_FORK, pid, trace_clock() - fork_started, 0, c.exe[0]);
+        return pid;
+    }
 
-            if (exel == size)
-            { // if no redirection symbol found yet
-                exel = i;
-            }
-        }
-        else if (!strcmp(arr[i], ">>"))
+    // the child, set up the way execute() sets up a program
+    if (pgid != -1)
+    {
+        setpgid(0, pgid);
+        if (foreground && pgid == 0)
         {
-            outl = i + 1;
-            temp.redir_out = 1;
-            temp.append = 1;
-            if (exel == size)
-            { // if no redirection symbol found yet
-                exel = i;
-            }
+            tcsetpgrp(STDIN_FILENO, getpid()); // SIGTTOU is still ignored at this point
         }
     }
-
-    temp.exe_size = exel;
-    copy_arr(arr, &(temp.exe), 0, exel);
-    temp.exe[temp.exe_size] = NULL;
-
-    if (inl != 0)
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigprocmask(SIG_SETMASK, &signals, NULL);
+
+    if (in_fd != -1)
     {
-        temp.in = malloc(sizeof(char *));
-        strcpy(temp.in, arr[inl]);
+        dup2(in_fd, STDIN_FILENO);
     }
-    if (outl != 0)
+    if (out_fd != -1)
     {
-        temp.out = malloc(sizeof(char *));
-        strcpy(temp.out, arr[outl]);
+        dup2(out_fd, STDOUT_FILENO);
     }
+    // a redirect lands on top of a pipe, same as in execute()
+    int fd = 0;
+    if (c.redir_in && (fd = open(c.in, O_RDONLY)) != -1)
+    {
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+    if (fd != -1 && c.redir_out && (fd = open(c.out, O_CREAT | O_WRONLY | (c.append ? O_APPEND : O_TRUNC), 0666)) != -1)
+    {
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+    if (fd == -1)
+    {
+        fprintf(stderr, "command %s failed: %s\n", c.exe[0], strerror(errno));
+        _exit(1);
+    }
+    // the pipes are close-on-exec, but there's no exec here. Close them (and anything else the shell
+    // has open) by hand, or whoever reads from this stage's pipe never sees EOF while it's running.
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+    close_range(3, ~0U, 0);
+#else
+    for (int fd = 3; fd < sysconf(_SC_OPEN_MAX); fd++)
+    {
+        close(fd);
+    }
+#endif
 
-    return temp;
+    int status = fn(c.exe);
+    fflush(stdout);
+    _exit(status);
 }
-